@@ -26,7 +26,16 @@
 #else
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
 #endif
 
 #include <iostream>
@@ -50,12 +59,36 @@ namespace cxx_utils
          * \brief An iostream style streambuf operating on stdio file descriptors
          * fdstreambuf takes a file descriptor, a buffer size, and a put-back
          * size.
-         * The fdstreambuf only overloads the overflow and underflow methods to
-         * provide a flush facility to C++ style streams.
+         * Output is collected in a put area of the same size and written
+         * when it fills, on sync() (std::flush, std::endl), before the next
+         * read, and on destruction. A write too large for the put area goes
+         * out together with what is pending in a single writev().
+         *
+         * Reads of at least a buffer's worth go straight into the caller's
+         * memory. The get area starts at the requested size and doubles,
+         * up to the read buffer limit, whenever a read fills it and
+         * FIONREAD says more is already waiting.
+         *
+         * In non-blocking mode (set_nonblocking()) a read that would block
+         * ends the current input like end-of-file does, but read_state()
+         * says io_would_block: clear() the stream and read again once the
+         * descriptor is readable. Output the descriptor won't take yet is
+         * kept, growing the put area as needed, and retried on the next
+         * write or sync(); pending_output() says how much is waiting, and
+         * a streambuf_monitor watches for writability while it is nonzero.
          */
         class fd_buffer : public std::streambuf
         {
         public:
+            /// The outcome of the last read from the descriptor.
+            enum io_state
+            {
+                io_ok,
+                io_would_block,
+                io_eof,
+                io_error
+            };
+
             /**
              * Construct a file-buffer from a file descriptor. It's best to use a
              * socket_buffer for socket descriptors; this keeps the distinction
@@ -69,25 +102,117 @@ namespace cxx_utils
                 : m_cBuffer(std::max<std::size_t>(nBufSize, nPutBack) +
                             nPutBack),
                   m_nFileDes(nFileDes), m_nPutBack(nPutBack),
-                  m_bOwner(bOwner)
+                  m_bOwner(bOwner),
+                  m_nMaxRead(std::max<std::size_t>(nBufSize, 65536)),
+                  m_bGrowRead(false), m_bNonBlocking(false),
+                  m_eReadState(io_ok)
             {
                 char *end = BufferStart() + m_cBuffer.size();
                 setg(end, end, end);
+                set_write_buffer(nBufSize);
             }
 
             fd_buffer( int nFileDes, bool bOwner )
                 : m_cBuffer(1032), m_nFileDes(nFileDes),
-                  m_nPutBack(8), m_bOwner( bOwner )
+                  m_nPutBack(8), m_bOwner( bOwner ), m_nMaxRead(65536),
+                  m_bGrowRead(false), m_bNonBlocking(false),
+                  m_eReadState(io_ok)
             {
                 char *end = BufferStart() + m_cBuffer.size();
                 setg(end,end,end);
+                set_write_buffer(1024);
             }
             
+            /**
+             * Flushes and closes the descriptor (if owned). In non-blocking
+             * mode it writes only what the descriptor takes right away and
+             * drops the rest of the backlog, since a stalled peer would
+             * otherwise hang it; call close() first to wait for it.
+             */
             virtual ~fd_buffer()
             {
+                flush_output();
                 if( m_nFileDes != -1 && m_bOwner ) fdclose(m_nFileDes);
             }
 
+            /**
+             * Writes out everything pending, waiting for the descriptor even
+             * in non-blocking mode, then closes it (if owned). Returns -1 if
+             * some output couldn't be written; it is dropped either way.
+             */
+            int close()
+            {
+                if( m_nFileDes == -1 ) return 0;
+                const bool bNonBlocking = m_bNonBlocking;
+                m_bNonBlocking = false;
+                const int result = sync();
+                m_bNonBlocking = bNonBlocking;
+                release();
+                return result;
+            }
+
+            /// Drops any pending output and closes the descriptor (if owned).
+            void abort()
+            {
+                if( m_nFileDes == -1 ) return;
+                setp(pbase(), epptr());
+                release();
+            }
+
+            /**
+             * Switches O_NONBLOCK on the descriptor and the would-block
+             * handling described above on or off together.
+             */
+            bool set_nonblocking(bool bNonBlocking)
+            {
+                int flags = fcntl(m_nFileDes, F_GETFL);
+                if( flags < 0 ) return false;
+                flags = bNonBlocking ? (flags | O_NONBLOCK) :
+                    (flags & ~O_NONBLOCK);
+                if( fcntl(m_nFileDes, F_SETFL, flags) < 0 ) return false;
+                m_bNonBlocking = bNonBlocking;
+                return true;
+            }
+
+            bool nonblocking() const { return m_bNonBlocking; }
+
+            io_state read_state() const { return m_eReadState; }
+
+            /// Bytes written to the stream but not yet to the descriptor.
+            std::size_t pending_output() const { return pptr() - pbase(); }
+
+            /// Bytes read from the descriptor but not yet by the stream.
+            std::size_t buffered_input() const { return egptr() - gptr(); }
+
+            /**
+             * Caps how large the get area may grow (excluding put-back);
+             * never shrinks the current buffer.
+             */
+            void set_read_buffer_limit(std::size_t nMax)
+            {
+                m_nMaxRead = nMax;
+            }
+
+            /// Current get area capacity, excluding put-back.
+            std::size_t read_buffer_size() const
+            {
+                return m_cBuffer.size() - m_nPutBack;
+            }
+
+            /**
+             * Resizes the put area, flushing whatever it holds first; 0 makes
+             * every write go straight to the descriptor.
+             */
+            void set_write_buffer(std::size_t nSize)
+            {
+                flush_output();
+                m_cOutBuffer.resize(nSize);
+                if( nSize )
+                    setp(&m_cOutBuffer.front(), &m_cOutBuffer.front() + nSize);
+                else
+                    setp(0, 0);
+            }
+
             std::streambuf::int_type underflow()
             {
                 if( m_nFileDes == -1 )
@@ -96,56 +221,301 @@ namespace cxx_utils
                 if(gptr() < egptr())
                     return std::streambuf::traits_type::to_int_type(*gptr());
 
+                // the peer may be waiting on our output before it replies
+                if( pptr() != pbase() && flush_output() < 0 &&
+                    !output_deferred() )
+                    return std::streambuf::traits_type::eof();
+
                 char *base  = BufferStart();
-                char *start = base;
+                std::size_t keep = 0;
 
                 if (eback() == base) // true when this isn't the first fill
                 {
                     // Make arrangements for putback characters
-                    ::memmove(base, egptr() - m_nPutBack, m_nPutBack);
-                    start += m_nPutBack;
+                    keep = std::min<std::size_t>(m_nPutBack, egptr() - base);
+                    ::memmove(base, egptr() - keep, keep);
+                }
+
+                if( m_bGrowRead )
+                {
+                    grow_read_buffer(keep);
+                    base = BufferStart();
                 }
 
-                ssize_t result =
-                    internal_read(start, m_cBuffer.size()-(start-base));
+                char *start = base + keep;
+                const std::size_t want = m_cBuffer.size() - keep;
+                ssize_t result = read_some(start, want);
                 if( result <= 0 )
                 {
+                    setg( base, start, start);
                     return std::streambuf::traits_type::eof();
                 }
 
                 setg( base, start, start+result);
+                if( std::size_t(result) == want &&
+                    read_buffer_size() < m_nMaxRead &&
+                    internal_rd_ioctl() > 0 )
+                    m_bGrowRead = true;
                 return std::streambuf::traits_type::to_int_type(*gptr());
             }
 
+            std::streamsize xsgetn(char *s, std::streamsize num)
+            {
+                std::streamsize got = 0;
+                while( got < num )
+                {
+                    const std::streamsize avail = egptr() - gptr();
+                    if( avail )
+                    {
+                        const std::streamsize n = std::min(avail, num - got);
+                        std::memcpy(s + got, gptr(), std::size_t(n));
+                        gbump(int(n));
+                        got += n;
+                        continue;
+                    }
+
+                    if( m_nFileDes == -1 ||
+                        num - got < std::streamsize(m_cBuffer.size()) )
+                    {
+                        if( traits_type::eq_int_type(underflow(),
+                                                     traits_type::eof()) )
+                            break;
+                        continue;
+                    }
+
+                    // a buffer or more to go: read into the caller's memory
+                    if( pptr() != pbase() && flush_output() < 0 )
+                        break;
+                    ssize_t result = read_some(s + got, std::size_t(num - got));
+                    if( result <= 0 )
+                        break;
+                    got += result;
+
+                    // what was just read doubles as the put-back area
+                    const std::size_t keep =
+                        std::min<std::size_t>(m_nPutBack, std::size_t(got));
+                    char *base = BufferStart();
+                    std::memcpy(base, s + got - keep, keep);
+                    setg(base, base + keep, base + keep);
+                }
+                return got;
+            }
+
             std::streambuf::int_type overflow(std::streambuf::int_type c)
             {
-                if( m_nFileDes == -1 )
+                if( m_nFileDes == -1 ||
+                    (flush_output() < 0 && !output_deferred()) )
                     return std::streambuf::traits_type::eof();
-                if( c != EOF)
+                if( traits_type::eq_int_type(c, traits_type::eof()) )
+                    return traits_type::not_eof(c);
+
+                char z = traits_type::to_char_type(c);
+                if( !pbase() )
                 {
-                    char z = c;
-                    ssize_t result = internal_write((void *)(&z),
-                                                    sizeof(char));
-                    if( result != 1 )
+                    if( write_all(&z, 1) == 1 )
+                        return c;
+                    if( !output_deferred() )
                         return std::streambuf::traits_type::eof();
                 }
-                return std::streambuf::traits_type::to_int_type(c);
+
+                reserve_output(1);
+                *pptr() = z;
+                pbump(1);
+                return c;
             }
 
             std::streamsize xsputn (const char* s, std::streamsize num)
             {
-                if( m_nFileDes == -1 )
-                    return std::streambuf::traits_type::eof();
+                if( m_nFileDes == -1 || num <= 0 )
+                    return 0;
 
-                ssize_t result = internal_write((void *)s,num);
-                if( result < 0 )
-                    return std::streambuf::traits_type::eof();
+                if( num <= epptr() - pptr() )
+                {
+                    std::memcpy(pptr(), s, num);
+                    pbump(int(num));
+                    return num;
+                }
 
-                return std::streamsize(result);
+                // too big for what's left: pending bytes and @s in one go
+                const std::size_t pending = pptr() - pbase();
+                struct iovec iov[2];
+                iov[0].iov_base = pbase();
+                iov[0].iov_len = pending;
+                iov[1].iov_base = const_cast<char *>(s);
+                iov[1].iov_len = std::size_t(num);
+                const std::size_t written = writev_all(iov, 2);
+                std::size_t sent = 0;
+                if( written < pending )
+                    keep_unwritten(written);
+                else
+                {
+                    setp(pbase(), epptr());
+                    sent = written - pending;
+                }
+
+                if( sent < std::size_t(num) && output_deferred() )
+                {
+                    // keep the rest for when the descriptor is writable
+                    reserve_output(num - sent);
+                    std::memcpy(pptr(), s + sent, num - sent);
+                    pbump(int(num - sent));
+                    sent = num;
+                }
+                return std::streamsize(sent);
             }
 
+            /// The descriptor being buffered, or -1.
+            int descriptor() const { return m_nFileDes; }
+
         protected:
 
+            virtual int sync()
+            {
+                return flush_output() < 0 && !output_deferred() ? -1 : 0;
+            }
+
+            /**
+             * After a failed write: whether it only would have blocked in
+             * non-blocking mode, so the bytes stay queued rather than fail.
+             */
+            bool output_deferred() const
+            {
+                return m_bNonBlocking && (errno == EAGAIN ||
+                                          errno == EWOULDBLOCK);
+            }
+
+            /// Makes room for @n more bytes in the put area, growing it.
+            void reserve_output(std::size_t n)
+            {
+                if( std::size_t(epptr() - pptr()) >= n ) return;
+                const std::size_t pending = pptr() - pbase();
+                m_cOutBuffer.resize(pending + std::max(n, m_cOutBuffer.size()));
+                char *base = &m_cOutBuffer.front();
+                setp(base, base + m_cOutBuffer.size());
+                pbump(int(pending));
+            }
+
+            /// Writes out the put area; returns -1 if any of it is left over.
+            int flush_output()
+            {
+                const std::size_t pending = pptr() - pbase();
+                if( !pending ) return 0;
+                if( m_nFileDes == -1 ) return -1;
+
+                const std::size_t written = write_all(pbase(), pending);
+                keep_unwritten(written);
+                return written == pending ? 0 : -1;
+            }
+
+            /// internal_read(), retried across EINTR.
+            ssize_t read_some(char *buf, std::size_t len)
+            {
+                ssize_t result;
+                do
+                {
+                    result = internal_read(buf, len);
+                } while( result < 0 && errno == EINTR );
+
+                m_eReadState = result > 0 ? io_ok : result == 0 ? io_eof :
+                    (errno == EAGAIN || errno == EWOULDBLOCK) ?
+                    io_would_block : io_error;
+                return result;
+            }
+
+            /**
+             * Doubles the get area (up to the limit), carrying over the
+             * @nKeep put-back bytes at its start.
+             */
+            void grow_read_buffer(std::size_t nKeep)
+            {
+                m_bGrowRead = false;
+                const std::size_t size = std::min(read_buffer_size() * 2,
+                                                  m_nMaxRead) + m_nPutBack;
+                if( size <= m_cBuffer.size() ) return;
+
+                std::vector<char> grown(size);
+                std::memcpy(&grown.front(), BufferStart(), nKeep);
+                m_cBuffer.swap(grown);
+                char *base = BufferStart();
+                setg(base, base + nKeep, base + nKeep);
+            }
+
+            /// Drops the first @nWritten bytes of the put area.
+            void keep_unwritten(std::size_t nWritten)
+            {
+                const std::size_t left = (pptr() - pbase()) - nWritten;
+                if( left ) ::memmove(pbase(), pbase() + nWritten, left);
+                setp(pbase(), epptr());
+                pbump(int(left));
+            }
+
+            /**
+             * Blocks until the descriptor takes more output, for descriptors
+             * that are non-blocking while this buffer is not.
+             */
+            bool wait_writable()
+            {
+                struct pollfd pfd;
+                pfd.fd = m_nFileDes;
+                pfd.events = POLLOUT;
+                int ret;
+                do
+                {
+                    ret = poll(&pfd, 1, -1);
+                } while( ret < 0 && errno == EINTR );
+                return ret > 0 && !(pfd.revents & (POLLERR | POLLNVAL));
+            }
+
+            /// Writes @len bytes through short writes, EINTR and EAGAIN.
+            std::size_t write_all(const char *buf, std::size_t len)
+            {
+                struct iovec iov;
+                iov.iov_base = const_cast<char *>(buf);
+                iov.iov_len = len;
+                return writev_all(&iov, 1);
+            }
+
+            /**
+             * Writes every segment of @iov (which is consumed), returning
+             * how many bytes went out; fewer than asked means an error,
+             * left in errno.
+             */
+            std::size_t writev_all(struct iovec *iov, int cnt)
+            {
+                std::size_t total = 0;
+                while( cnt && !iov->iov_len ) { ++iov; --cnt; }
+                while( cnt )
+                {
+                    ssize_t result = cnt == 1 ?
+                        internal_write(iov->iov_base, iov->iov_len) :
+                        internal_writev(iov, cnt);
+                    if( result < 0 )
+                    {
+                        if( errno == EINTR ) continue;
+                        if( (errno == EAGAIN || errno == EWOULDBLOCK) &&
+                            !m_bNonBlocking && wait_writable() )
+                            continue;
+                        break;
+                    }
+                    if( result == 0 ) break;
+
+                    total += std::size_t(result);
+                    std::size_t done = std::size_t(result);
+                    while( cnt && done >= iov->iov_len )
+                    {
+                        done -= iov->iov_len;
+                        ++iov;
+                        --cnt;
+                    }
+                    if( cnt )
+                    {
+                        iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+                        iov->iov_len -= done;
+                    }
+                }
+                return total;
+            }
+
             virtual std::streamsize showmanyc()
             {
                 std::streamsize result = 0;
@@ -194,17 +564,139 @@ namespace cxx_utils
             virtual ssize_t internal_write(void *buf, size_t len)
             { return write(m_nFileDes, buf, len); }
 
+            virtual ssize_t internal_writev(const struct iovec *iov, int cnt)
+            { return writev(m_nFileDes, iov, cnt); }
+
             virtual void fdclose(int fd)
-            { close(fd); }
+            { ::close(fd); }
+
+            /// Forgets the descriptor, closing it if owned; input is kept.
+            void release()
+            {
+                setp(pbase(), epptr());
+                if( m_bOwner ) fdclose(m_nFileDes);
+                m_nFileDes = -1;
+            }
+
+            /**
+             * Whether transfer() may move data on the descriptor behind this
+             * buffer's back; false for subclasses with I/O of their own in
+             * flight.
+             */
+            virtual bool direct_io() const { return true; }
             
             char *BufferStart(){ return &m_cBuffer.front(); }
+
+            friend std::size_t transfer(fd_buffer &rSrc, fd_buffer &rDst,
+                                        std::size_t n);
         
             std::vector<char> m_cBuffer;
+            std::vector<char> m_cOutBuffer;
             int               m_nFileDes;
             const std::size_t m_nPutBack;
             bool              m_bOwner;
+            std::size_t       m_nMaxRead;
+            bool              m_bGrowRead;
+            bool              m_bNonBlocking;
+            io_state          m_eReadState;
         };
 
+        /**
+         * Moves up to @n bytes (by default, everything up to end of input)
+         * from @rSrc to @rDst. Bytes already buffered in @rSrc go first;
+         * the rest is moved inside the kernel where the descriptor types
+         * allow: copy_file_range() between regular files, splice() when
+         * either end is a pipe, sendfile() from a regular file to anything
+         * else (a socket, say). Otherwise, or when the kernel refuses, it
+         * falls back to a buffered copy through both streambufs.
+         *
+         * Returns the number of bytes moved. Fewer than @n means end of
+         * input or an error left in errno. On a non-blocking descriptor,
+         * it can also mean EAGAIN.
+         */
+        inline std::size_t transfer(fd_buffer &rSrc, fd_buffer &rDst,
+                                    std::size_t n = std::size_t(-1))
+        {
+            std::size_t moved = 0;
+            if( rSrc.m_nFileDes == -1 || rDst.m_nFileDes == -1 ||
+                rDst.flush_output() < 0 )
+                return 0;
+
+            const std::size_t buffered =
+                std::min<std::size_t>(n, rSrc.egptr() - rSrc.gptr());
+            if( buffered )
+            {
+                moved = rDst.write_all(rSrc.gptr(), buffered);
+                rSrc.gbump(int(moved));
+                if( moved < buffered ) return moved;
+            }
+
+#ifdef __linux__
+            struct stat src, dst;
+            if( moved < n && rSrc.direct_io() && rDst.direct_io() &&
+                !fstat(rSrc.m_nFileDes, &src) && !fstat(rDst.m_nFileDes, &dst) )
+            {
+                enum { copy_range, splice_pipe, send_file, buffered_copy } how =
+                    S_ISREG(src.st_mode) && S_ISREG(dst.st_mode) ? copy_range :
+                    S_ISFIFO(src.st_mode) || S_ISFIFO(dst.st_mode) ? splice_pipe :
+                    S_ISREG(src.st_mode) ? send_file : buffered_copy;
+
+                bool bFirst = true;
+                while( how != buffered_copy && moved < n )
+                {
+                    const std::size_t chunk =
+                        std::min<std::size_t>(n - moved, 1u << 30);
+                    ssize_t result;
+                    switch( how )
+                    {
+                    case copy_range:
+                        result = copy_file_range(rSrc.m_nFileDes, NULL,
+                                                 rDst.m_nFileDes, NULL,
+                                                 chunk, 0);
+                        break;
+                    case splice_pipe:
+                        result = splice(rSrc.m_nFileDes, NULL,
+                                        rDst.m_nFileDes, NULL, chunk,
+                                        SPLICE_F_MOVE | SPLICE_F_MORE);
+                        break;
+                    default:
+                        result = sendfile(rDst.m_nFileDes, rSrc.m_nFileDes,
+                                          NULL, chunk);
+                        break;
+                    }
+
+                    if( result > 0 )
+                    {
+                        moved += std::size_t(result);
+                        bFirst = false;
+                        continue;
+                    }
+                    if( result == 0 ) return moved;
+                    if( errno == EINTR ) continue;
+                    if( bFirst && (errno == EINVAL || errno == ENOSYS ||
+                                   errno == EXDEV || errno == EOPNOTSUPP) )
+                        break;
+                    return moved;
+                }
+            }
+#endif
+
+            std::vector<char> buf;
+            while( moved < n )
+            {
+                if( buf.empty() ) buf.resize(65536);
+                const std::streamsize want =
+                    std::streamsize(std::min<std::size_t>(n - moved, buf.size()));
+                const std::streamsize got = rSrc.sgetn(&buf.front(), want);
+                if( got <= 0 ) break;
+                const std::streamsize put = rDst.sputn(&buf.front(), got);
+                if( put > 0 ) moved += std::size_t(put);
+                if( put < got ) break;
+            }
+            rDst.pubsync();
+            return moved;
+        }
+
         /**
          * @brief A "Process-Input" stream, providing an easy way to read the
          * output of a platform external process.
@@ -258,6 +750,7 @@ namespace cxx_utils
             
             virtual ~postream()
             {
+                if( m_pOpenedStream ) m_pOpenedStream->pubsync();
                 if( m_pFile ) CXX_USEFUL_PCLOSE( m_pFile );
                 delete m_pOpenedStream;
             }
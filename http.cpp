@@ -1,7 +1,74 @@
 #include "http_utils.hpp"
 #include "http_message.hpp"
 #include <iostream>
+#include <algorithm>
+#include <sstream>
+#include <vector>
 using cxx_utils::net::http::utils;
+using cxx_utils::net::http::http_message;
+using cxx_utils::net::http::http_request;
+using cxx_utils::net::http::http_response;
+using cxx_utils::net::http::query_params;
+
+static bool check_request_split(const std::string &raw, size_t step,
+                                bool use_sink = false)
+{
+    http_request request;
+    std::ostringstream sunk;
+    if (use_sink)
+        request.set_body_sink(sunk.rdbuf());
+    http_message::feed_result res = { 0, http_message::parse_incomplete };
+    for (size_t pos = 0; pos < raw.size(); pos += step) {
+        res = request.feed(raw.data() + pos,
+                           std::min(step, raw.size() - pos));
+    }
+
+    std::string host;
+    if (res.status != http_message::parse_complete ||
+        request.method() != http_request::post_method ||
+        request.uri() != "/submit?x=1" ||
+        !request.get_header("host", host) || host != "example.org" ||
+        (use_sink ? sunk.str() : request.body()) != "hello=world") {
+        std::cout << "Failed to parse request fed in " << step
+                  << " byte pieces" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool check_response_split(const std::string &raw, size_t step)
+{
+    http_response response;
+    http_message::feed_result res = { 0, http_message::parse_incomplete };
+    for (size_t pos = 0; pos < raw.size(); pos += step) {
+        res = response.feed(raw.data() + pos,
+                            std::min(step, raw.size() - pos));
+    }
+    if (res.status == http_message::parse_incomplete)
+        res = response.finish();
+
+    std::string type;
+    if (res.status != http_message::parse_complete ||
+        response.code() != http_response::not_found ||
+        response.reason() != "Not Found" ||
+        !response.get_header("Content-Type", type) || type != "text/plain" ||
+        response.body() != "no such page") {
+        std::cout << "Failed to parse response fed in " << step
+                  << " byte pieces" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/// A subclass written against the old API: append, then updated().
+struct legacy_request : public cxx_utils::net::http::http_request
+{
+    void append(char c)
+    {
+        m_accumulator += c;
+        updated();
+    }
+};
 
 int main()
 {
@@ -64,14 +131,391 @@ int main()
         }
     }
 
+    // long inputs exercise the block-at-a-time paths; every byte except
+    // '+' (which decodes to a space) must survive a round trip
+    for (size_t len = 0; len < 100; ++len) {
+        std::string plain;
+        for (size_t i = 0; i < len; ++i) {
+            char c = char((i * 37 + len * 11) & 0xff);
+            plain += (c == '+' || (i % 7) != 3) ? char('a' + i % 26) : c;
+        }
+        std::string inplace = utils::urlencode(plain);
+        utils::urldecode_inplace(inplace);
+        if (utils::urldecode(utils::urlencode(plain)) != plain ||
+            inplace != plain) {
+            std::cout << "URL round trip failed for length " << len
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    std::string appended("q=");
+    utils::urlencode_append(appended, "\xff x", 3);
+    if (appended != "q=%FF%2Bx") {
+        std::cout << "Got [" << appended << "] appending" << std::endl;
+        return 1;
+    }
+
     std::cout << "URL Encode / Decode finished" << std::endl;
 
+    if (utils::httpdate(784111777) != "Sun, 06 Nov 1994 08:49:37 GMT" ||
+        utils::httpdate(784111777) != "Sun, 06 Nov 1994 08:49:37 GMT") {
+        std::cout << "Bad IMF-fixdate [" << utils::httpdate(784111777) << "]"
+                  << std::endl;
+        return 1;
+    }
+
     std::string req = "GET /index.html HTTP/1.0\r\nUser-Agent: Fiction\r\nServer: localhost\r\n\r\n";
 
     cxx_utils::net::http::http_request request;
     request << req;
 
     std::cout << request;
-    
+
+    const std::string post = "POST /submit?x=1 HTTP/1.1\r\n"
+        "Host:  example.org \r\nContent-Length: 11\r\n\r\nhello=world";
+    for (size_t step = 1; step <= post.size(); ++step) {
+        if (!check_request_split(post, step))
+            return 1;
+    }
+
+    const std::string chunked = "POST /submit?x=1 HTTP/1.1\r\n"
+        "Host: example.org\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5;ext=1\r\nhello\r\n6\r\n=world\r\n0\r\nX-Trailer: yes\r\n\r\n";
+    for (size_t step = 1; step <= chunked.size(); ++step) {
+        if (!check_request_split(chunked, step, (step & 1) != 0))
+            return 1;
+    }
+
+    http_request badchunk;
+    badchunk << "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "zz\r\n";
+    if (badchunk.suggested() != cxx_utils::net::http::http_response::bad_request) {
+        std::cout << "Malformed chunk size was not rejected" << std::endl;
+        return 1;
+    }
+
+    const char *framing_trailers[] = {
+        "Content-Length: 5", "Transfer-Encoding: identity", "Host: evil.example"
+    };
+    for (size_t i = 0; i < sizeof(framing_trailers) / sizeof(char *); ++i) {
+        http_request smuggled;
+        smuggled << std::string("POST / HTTP/1.1\r\nHost: example.org\r\n"
+                                "Transfer-Encoding: chunked\r\n\r\n"
+                                "5\r\nhello\r\n0\r\n") +
+            framing_trailers[i] + "\r\n\r\n";
+        std::string host;
+        if (smuggled.suggested() !=
+            cxx_utils::net::http::http_response::bad_request ||
+            !smuggled.get_header("Host", host) || host != "example.org") {
+            std::cout << "Trailer [" << framing_trailers[i]
+                      << "] was not rejected" << std::endl;
+            return 1;
+        }
+    }
+
+    const std::string responses[] = {
+        "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n"
+        "Content-Length: 12\r\n\r\nno such page",
+        "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n3\r\nno \r\n9\r\nsuch page"
+        "\r\n0\r\n\r\n",
+        "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\n\r\n"
+        "no such page"
+    };
+    for (size_t i = 0; i < sizeof(responses) / sizeof(responses[0]); ++i) {
+        for (size_t step = 1; step <= responses[i].size(); ++step) {
+            if (!check_response_split(responses[i], step))
+                return 1;
+        }
+    }
+
+    http_response built(http_response::not_found);
+    built.set_header("Content-Type", "text/plain");
+    built.set_header("Date", "Sat, 17 Oct 2026 12:00:00 GMT");
+    built.set_body("no such page");
+    char wire[256];
+    size_t wirelen = built.serialize(wire, sizeof(wire));
+    if (wirelen > sizeof(wire) ||
+        std::string(wire, 24) != "HTTP/1.1 404 Not Found\r\n" ||
+        !check_response_split(std::string(wire, wirelen), wirelen) ||
+        built.serialize() != std::string(wire, wirelen)) {
+        std::cout << "Response did not survive serialization" << std::endl;
+        return 1;
+    }
+
+    std::string big(1 << 20, 'x');
+    built.set_body(big);
+    std::vector<struct iovec> iov;
+    std::string headbuf;
+    size_t total = built.serialize(iov, headbuf);
+    if (iov.size() != 2 || iov[1].iov_base != built.body().data() ||
+        total != iov[0].iov_len + big.size() ||
+        std::string((const char *)iov[0].iov_base, iov[0].iov_len) +
+        big != built.serialize()) {
+        std::cout << "Gathered response does not match" << std::endl;
+        return 1;
+    }
+
+    // neither a moved-in nor a referenced body is copied on the way out
+    std::string moved(1 << 20, 'm');
+    const char *moved_data = moved.data();
+    built.set_body(std::move(moved));
+    built.serialize(iov, headbuf);
+    const bool moved_ok = iov.size() == 2 && iov[1].iov_base == moved_data;
+    built.set_body_ref(big.data(), big.size());
+    total = built.serialize(iov, headbuf);
+    if (!moved_ok || iov.size() != 2 || iov[1].iov_base != big.data() ||
+        !built.body().empty() || built.wire_body().size() != big.size() ||
+        std::string((const char *)iov[0].iov_base, iov[0].iov_len)
+        .find("Content-Length: 1048576\r\n") == std::string::npos ||
+        total != iov[0].iov_len + big.size()) {
+        std::cout << "Body was copied on serialization" << std::endl;
+        return 1;
+    }
+
+    http_request posted(http_request::post_method, "/upload", 1, 1);
+    posted.set_header("Host", "example.org");
+    posted.set_header("Date", "Sat, 17 Oct 2026 12:00:00 GMT");
+    posted.set_body("hello=world");
+    posted.serialize(iov, headbuf);
+    std::string reposted((const char *)iov[0].iov_base, iov[0].iov_len);
+    reposted.append((const char *)iov[1].iov_base, iov[1].iov_len);
+    if (reposted != posted.serialize() ||
+        !check_request_split("POST /submit?x=1" +
+                             reposted.substr(reposted.find(" HTTP/")), 7)) {
+        std::cout << "Gathered request does not round-trip" << std::endl;
+        return 1;
+    }
+
+    http_request search;
+    search << "GET /find?q=caf%C3%A9+au+lait&&empty=&flag&q=2#top HTTP/1.1\r\n\r\n";
+    query_params params(search.query());
+    cxx_utils::string::string_ref qval;
+    if (params.size() != 4 || !params.find("q", qval) ||
+        qval != "caf\xc3\xa9 au lait" || !params.find("empty", qval) ||
+        !qval.empty() || !params.has("flag") || params.has("top") ||
+        params[3].value != "2") {
+        std::cout << "Query string parsing failed" << std::endl;
+        return 1;
+    }
+
+    params.parse("user%20name=a%26b&pass=x%3Dy");
+    if (params.size() != 2 || params[0].key != "user name" ||
+        params[0].value != "a&b" || params[1].value != "x=y") {
+        std::cout << "Form body parsing failed" << std::endl;
+        return 1;
+    }
+
+    // copies and moves refer to their own arena, not the source's
+    query_params copied(params);
+    params.parse("other=1");
+    query_params taken(std::move(copied));
+    copied.parse("x=y&z=w");
+    if (taken.size() != 2 || taken[0].key != "user name" ||
+        taken[1].value != "x=y" || params[0].key != "other") {
+        std::cout << "Query params copy/move failed" << std::endl;
+        return 1;
+    }
+    params = taken;
+    taken = query_params("k=v");
+    if (params.size() != 2 || params[0].value != "a&b" ||
+        taken.size() != 1 || taken[0].value != "v") {
+        std::cout << "Query params assignment failed" << std::endl;
+        return 1;
+    }
+
+    http_request jar;
+    jar << "GET / HTTP/1.1\r\nCookie: sid=abc123; theme = dark\r\n"
+        "Cookie: lang=en\r\n\r\n";
+    cxx_utils::string::string_ref cval;
+    if (jar.cookies().size() != 3 || !jar.find_cookie("theme", cval) ||
+        cval != "dark" || !jar.find_cookie("lang", cval) || cval != "en" ||
+        jar.find_cookie("sid=abc123", cval) ||
+        jar.serialize().find("Cookie: sid=abc123; theme=dark; lang=en\r\n")
+        == std::string::npos) {
+        std::cout << "Cookie index failed" << std::endl;
+        return 1;
+    }
+
+    http_response setter;
+    setter << "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n"
+        "Set-Cookie: sid=xyz; Domain=.example.org; Expires=Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+        "Set-Cookie: pref=1; Expires=Sunday, 06-Nov-94 08:49:37 GMT; max-age=60\r\n\r\n";
+    timeval expires;
+    std::string cdomain, cname;
+    if (setter.set_cookie_count() != 2 ||
+        !setter.set_cookie(0).expiration(expires) ||
+        expires.tv_sec != 784111777 ||
+        !setter.set_cookie(0).domain(cdomain) || cdomain != "example.org" ||
+        !setter.set_cookie(0).name(cname) || cname != "sid" ||
+        !setter.set_cookie(1).expiration(expires) ||
+        expires.tv_sec < time(NULL) + 59 ||
+        !(setter.set_cookie(1) == "pref")) {
+        std::cout << "Set-Cookie attributes failed" << std::endl;
+        return 1;
+    }
+
+    http_response head_out(http_response::okay);
+    head_out.set_head_response(true);
+    const std::string no_length = head_out.serialize();
+    head_out.set_header("Content-Length", "1234");
+    if (no_length.find("Content-Length") != std::string::npos ||
+        head_out.serialize().find("Content-Length: 1234\r\n") ==
+        std::string::npos) {
+        std::cout << "HEAD response Content-Length wrong" << std::endl;
+        return 1;
+    }
+
+    http_response head;
+    head.set_head_response(true);
+    if (head.feed("HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n", 38).status
+        != http_message::parse_complete) {
+        std::cout << "HEAD response expected a body" << std::endl;
+        return 1;
+    }
+
+    const std::string pipelined = "GET /a HTTP/1.1\r\nHost: one\r\n\r\n"
+        "POST /b HTTP/1.1\r\nHost: two\r\nContent-Length: 3\r\n\r\nxyz"
+        "PUT /c HTTP/1.1\r\nHost: three\r\nTransfer-Encoding: chunked\r\n"
+        "\r\n2\r\nok\r\n0\r\n\r\nGET /d HTTP/1.1\r\n";
+    const char *expect_uri[] = { "/a", "/b", "/c" };
+    const char *expect_body[] = { "", "xyz", "ok" };
+    http_request conn;
+    size_t offset = 0;
+    for (int n = 0; n < 3; ++n) {
+        http_message::feed_result res =
+            conn.feed(pipelined.data() + offset, pipelined.size() - offset);
+        offset += res.consumed;
+        if (res.status != http_message::parse_complete ||
+            conn.uri() != expect_uri[n] || conn.body() != expect_body[n]) {
+            std::cout << "Pipelined request " << n << " failed" << std::endl;
+            return 1;
+        }
+        conn.reset();
+    }
+    if (conn.feed(pipelined.data() + offset,
+                  pipelined.size() - offset).status !=
+        http_message::parse_incomplete || conn.uri() != "/d") {
+        std::cout << "Trailing pipelined request failed" << std::endl;
+        return 1;
+    }
+
+    http_request overrun;
+    overrun << "GET / HTTP/1.1\r\n\r\nX";
+    if (overrun.suggested() !=
+        cxx_utils::net::http::http_response::request_entity_too_large) {
+        std::cout << "Bytes past a streamed request were accepted" << std::endl;
+        return 1;
+    }
+
+    http_request bad;
+    bad << "BREW /pot HTTP/1.1\r\n";
+    if (bad.suggested() != cxx_utils::net::http::http_response::not_implemented) {
+        std::cout << "Unknown method was not rejected" << std::endl;
+        return 1;
+    }
+
+    for (int hdr = 0; hdr < http_message::max_header; ++hdr) {
+        std::string name =
+            http_message::header_name(http_message::known_headers(hdr));
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (http_message::classify_header(name) != hdr) {
+            std::cout << "Known header " << name << " misclassified"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    std::string extra;
+    http_request tail;
+    tail << "GET / HTTP/1.1\r\nX-Request-Id: 42\r\nHosts: no\r\n\r\n";
+    if (http_message::classify_header("Hosts") != http_message::max_header ||
+        !tail.get_header("x-request-id", extra) || extra != "42" ||
+        tail.get_header("Host", extra)) {
+        std::cout << "Extension header lookup failed" << std::endl;
+        return 1;
+    }
+
+    // a repeated or re-set extension header replaces the earlier value
+    tail.reset();
+    tail << "GET / HTTP/1.1\r\nX-Tag: a\r\nx-tag: b\r\n\r\n";
+    tail.set_header("X-TAG", "c");
+    tail.set_header("X-Other", "d");
+    const std::string retagged = tail.serialize();
+    if (!tail.get_header("X-Tag", extra) || extra != "c" ||
+        retagged.find("X-Tag: c\r\nX-Other: d\r\n") == std::string::npos ||
+        retagged.find(": b") != std::string::npos) {
+        std::cout << "Extension header replacement failed" << std::endl;
+        return 1;
+    }
+
+    http_message::parser_limits limits;
+    limits.max_start_line = 64;
+    limits.max_header_bytes = 128;
+    limits.max_header_count = 4;
+    limits.max_body = 16;
+
+    struct limit_case {
+        std::string raw;
+        cxx_utils::net::http::http_response::codes code;
+    } const limit_cases[] = {
+        { "GET /" + std::string(80, 'a') + " HTTP/1.1\r\n\r\n",
+          cxx_utils::net::http::http_response::request_uri_too_large },
+        { "GET / HTTP/1.1\r\nX-Big: " + std::string(200, 'b') + "\r\n\r\n",
+          cxx_utils::net::http::http_response::request_header_fields_too_large },
+        { "GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\nC: 3\r\nD: 4\r\nE: 5\r\n\r\n",
+          cxx_utils::net::http::http_response::request_header_fields_too_large },
+        { "POST / HTTP/1.1\r\nContent-Length: 17\r\n\r\n",
+          cxx_utils::net::http::http_response::request_entity_too_large },
+        { "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+          "a\r\n0123456789\r\na\r\n0123456789\r\n0\r\n\r\n",
+          cxx_utils::net::http::http_response::request_entity_too_large },
+    };
+    for (size_t n = 0; n < sizeof(limit_cases) / sizeof(limit_cases[0]); ++n) {
+        // byte at a time too, so a limit can't be dodged by splitting
+        for (size_t step = 1; step <= limit_cases[n].raw.size();
+             step += limit_cases[n].raw.size() - 1) {
+            http_request limited;
+            limited.set_limits(limits);
+            const std::string &raw = limit_cases[n].raw;
+            http_message::feed_result res;
+            for (size_t off = 0; off < raw.size(); off += step) {
+                res = limited.feed(raw.data() + off,
+                                   std::min(step, raw.size() - off));
+                if (res.status != http_message::parse_incomplete)
+                    break;
+            }
+            if (res.status != http_message::parse_error ||
+                limited.suggested() != limit_cases[n].code) {
+                std::cout << "Parser limit " << n << " not enforced"
+                          << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    http_request within;
+    within.set_limits(limits);
+    within << "POST /ok HTTP/1.1\r\nContent-Length: 16\r\n\r\n"
+              "0123456789abcdef";
+    if (within.suggested() != cxx_utils::net::http::http_response::max_code ||
+        within.body().size() != 16) {
+        std::cout << "Request within limits was rejected" << std::endl;
+        return 1;
+    }
+
+    legacy_request legacy;
+    const std::string legacy_raw = "GET /old?api=1 HTTP/1.1\r\nHost: h\r\n\r\n";
+    for (size_t i = 0; i < legacy_raw.size(); ++i)
+        legacy.append(legacy_raw[i]);
+    if (legacy.uri() != "/old?api=1" || !legacy.get_header("Host", extra) ||
+        extra != "h") {
+        std::cout << "updated() compatibility path failed" << std::endl;
+        return 1;
+    }
+
+    std::cout << "HTTP request parsing finished" << std::endl;
+
     return 0;
 }
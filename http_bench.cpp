@@ -0,0 +1,150 @@
+#include "http_message.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+using cxx_utils::net::http::http_message;
+using cxx_utils::net::http::http_request;
+
+// Every heap allocation in the process goes through here, so the numbers
+// below include whatever the parser and serializer do behind our back.
+static size_t allocations = 0;
+
+void *operator new(std::size_t size)
+{
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+struct workload
+{
+    const char *name;
+    std::string stream;   ///< one or more back to back requests
+    size_t requests;
+};
+
+static workload small_gets()
+{
+    workload w = { "small GET", std::string(), 1 };
+    w.stream = "GET /index.html?lang=en HTTP/1.1\r\n"
+        "Host: www.example.org\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:47.0) Gecko/20100101\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "X-Forwarded-For: 203.0.113.7, 198.51.100.23\r\n"
+        "X-Request-Id: 6f1c2d3e-4b5a-4c7d-9e8f-0a1b2c3d4e5f\r\n"
+        "Connection: keep-alive\r\n\r\n";
+    return w;
+}
+
+static workload big_cookies()
+{
+    workload w = { "large Cookie", std::string(), 1 };
+    w.stream = "GET /account HTTP/1.1\r\nHost: www.example.org\r\nCookie: ";
+    for (int i = 0; i < 40; ++i) {
+        if (i)
+            w.stream += "; ";
+        w.stream += "tracker_" + std::to_string(i) + "=" +
+            std::string(48, char('a' + i % 26));
+    }
+    w.stream += "\r\nAccept: */*\r\n\r\n";
+    return w;
+}
+
+static workload big_post()
+{
+    workload w = { "64K POST", std::string(), 1 };
+    const std::string body(65536, 'x');
+    w.stream = "POST /upload HTTP/1.1\r\nHost: www.example.org\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    return w;
+}
+
+static workload pipelined()
+{
+    workload w = { "pipelined x16", std::string(), 16 };
+    for (size_t i = 0; i < w.requests; ++i) {
+        w.stream += "GET /item/" + std::to_string(i) + " HTTP/1.1\r\n"
+            "Host: api.example.org\r\nAccept: application/json\r\n\r\n";
+    }
+    return w;
+}
+
+/**
+ * Parses the workload's stream @rounds times on @request (reused, as on a
+ * keep-alive connection) and re-serializes every request into @out.
+ */
+static bool run(const workload &w, unsigned rounds, http_request &request,
+                std::vector<char> &out)
+{
+    for (unsigned r = 0; r < rounds; ++r) {
+        const char *p = w.stream.data();
+        const char *const end = p + w.stream.size();
+        for (size_t n = 0; n < w.requests; ++n) {
+            request.reset();
+            http_message::feed_result res = request.feed(p, end - p);
+            if (res.status != http_message::parse_complete ||
+                request.serialize(&out[0], out.size()) > out.size()) {
+                std::cout << w.name << ": round trip failed" << std::endl;
+                return false;
+            }
+            p += res.consumed;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    const workload corpus[] = {
+        small_gets(), big_cookies(), big_post(), pipelined()
+    };
+
+    for (size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); ++i) {
+        const workload &w = corpus[i];
+        const unsigned rounds =
+            static_cast<unsigned>(200000000 / (w.stream.size() * 8)) + 1;
+
+        http_request request;
+        std::vector<char> out(w.stream.size() + 1024);
+        // warm up first so buffer growth isn't charged to steady state,
+        // but report what it cost
+        allocations = 0;
+        if (!run(w, 1, request, out))
+            return 1;
+        const size_t warmup = allocations;
+
+        allocations = 0;
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        if (!run(w, rounds, request, out))
+            return 1;
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        const size_t allocs = allocations;
+
+        const double requests = double(rounds) * w.requests;
+        std::cout << w.name << ": "
+                  << w.stream.size() * double(rounds) / elapsed.count() /
+                     (1024.0 * 1024.0) << " MB/s, "
+                  << requests / elapsed.count() << " requests/s, "
+                  << allocs << " allocations in " << requests
+                  << " requests (" << allocs / requests << "/request, "
+                  << warmup << " warming up)" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+// Split-invariance fuzzer for the incremental HTTP parser: however a byte
+// stream is cut into feed() calls, it must parse to exactly the same
+// sequence of requests (or the same error) as when fed in one piece.
+//
+// Built standalone (make fuzz) it mutates a small seed corpus itself; built
+// with -DHTTP_FUZZ_LIBFUZZER and -fsanitize=fuzzer it exposes the usual
+// LLVMFuzzerTestOneInput entry point instead.
+
+#include "http_message.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using cxx_utils::net::http::http_message;
+using cxx_utils::net::http::http_request;
+
+/// xorshift64*; deterministic so a failing seed can be replayed.
+class prng
+{
+    std::uint64_t m_state;
+public:
+    explicit prng(std::uint64_t seed) : m_state(seed | 1) {}
+
+    std::uint64_t next()
+    {
+        m_state ^= m_state >> 12;
+        m_state ^= m_state << 25;
+        m_state ^= m_state >> 27;
+        return m_state * 2685821657736338717ull;
+    }
+
+    std::size_t below(std::size_t n) { return n ? next() % n : 0; }
+};
+
+/// Everything observable about a parsed (or rejected) request.
+static std::string digest(const http_request &req,
+                          http_message::parse_status status)
+{
+    std::ostringstream out;
+    out << status << '|' << req.suggested() << '|' << req.error() << '|';
+    if (status != http_message::parse_complete)
+        return out.str();
+
+    out << req.method() << '|' << req.uri() << '|';
+    for (int hdr = 0; hdr < http_message::max_header; ++hdr) {
+        cxx_utils::string::string_ref val;
+        if (req.get_header(http_message::known_headers(hdr), val))
+            out << hdr << '=' << val << '|';
+    }
+    const http_message::cookie_index &jar = req.cookies();
+    for (size_t i = 0; i < jar.size(); ++i)
+        out << req.view(jar[i].name) << '=' << req.view(jar[i].value) << ';';
+    out << '|' << req.set_cookie_count() << '|' << req.body();
+    return out.str();
+}
+
+/**
+ * Feeds [data, data+size) cut at @cuts (ascending offsets) through one
+ * request object, resetting between pipelined messages, and returns the
+ * digest of every message seen.
+ */
+static std::vector<std::string>
+parse_pieces(const char *data, std::size_t size,
+             const std::vector<std::size_t> &cuts)
+{
+    std::vector<std::string> seen;
+    http_request req;
+    http_message::parser_limits limits;
+    limits.max_header_bytes = 4096;
+    limits.max_body = 1 << 20;
+    req.set_limits(limits);
+
+    bool pending = false;
+    std::size_t from = 0;
+    for (std::size_t c = 0; c <= cuts.size(); ++c) {
+        const std::size_t to = c < cuts.size() ? cuts[c] : size;
+        const char *p = data + from;
+        const char *const end = data + to;
+        from = to;
+        while (p != end) {
+            http_message::feed_result res = req.feed(p, end - p);
+            p += res.consumed;
+            if (res.status == http_message::parse_incomplete) {
+                if (p != end) {
+                    seen.push_back("stalled");
+                    return seen;
+                }
+                pending = true;
+                break;
+            }
+            seen.push_back(digest(req, res.status));
+            if (res.status == http_message::parse_error)
+                return seen;
+            req.reset();
+            pending = false;
+        }
+    }
+    if (pending)
+        seen.push_back(digest(req, http_message::parse_incomplete));
+    return seen;
+}
+
+/// Compares the one-piece parse of the input against a random split of it.
+static bool check_input(const char *data, std::size_t size, prng &rng)
+{
+    const std::vector<std::string> whole =
+        parse_pieces(data, size, std::vector<std::size_t>());
+
+    std::vector<std::size_t> cuts;
+    const std::size_t style = rng.below(3);
+    for (std::size_t pos = 0; pos < size; ) {
+        // byte at a time, tiny pieces, or a few large ones
+        pos += style == 0 ? 1 : style == 1 ? 1 + rng.below(8) :
+            1 + rng.below(size);
+        if (pos < size)
+            cuts.push_back(pos);
+    }
+
+    if (parse_pieces(data, size, cuts) == whole)
+        return true;
+
+    std::cout << "Split parse differs for input:" << std::endl
+              << std::string(data, size) << std::endl << "cut at:";
+    for (std::size_t i = 0; i < cuts.size(); ++i)
+        std::cout << ' ' << cuts[i];
+    std::cout << std::endl;
+    return false;
+}
+
+#ifdef HTTP_FUZZ_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t *data,
+                                      std::size_t size)
+{
+    std::uint64_t seed = 14695981039346656037ull;
+    for (std::size_t i = 0; i < size; ++i)
+        seed = (seed ^ data[i]) * 1099511628211ull;
+    prng rng(seed);
+    if (!check_input(reinterpret_cast<const char *>(data), size, rng))
+        std::abort();
+    return 0;
+}
+
+#else
+
+static const char *const seeds[] = {
+    "GET / HTTP/1.1\r\nHost: a\r\n\r\n",
+    "POST /submit?x=1 HTTP/1.1\r\nHost: example.org\r\n"
+    "Content-Length: 11\r\nCookie: a=1; b=2\r\n\r\nhello=world",
+    "POST /c HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+    "5;ext=1\r\nhello\r\n6\r\n=world\r\n0\r\nX-Trailer: yes\r\n\r\n",
+    "GET /a HTTP/1.1\r\nHost: one\r\n\r\n"
+    "PUT /b HTTP/1.0\r\nContent-Length: 2\r\n\r\nhi"
+    "DELETE /c HTTP/1.1\r\n\r\n",
+    "OPTIONS * HTTP/1.1\n  Host:\tspaced  \nX-Extra: 1\n\n",
+};
+
+/// One random edit: flip, insert, delete or duplicate a span.
+static void mutate(std::string &input, prng &rng)
+{
+    static const char interesting[] = " \t\r\n:;=%0123456789abcdefxX-";
+    const std::size_t at = rng.below(input.size() + 1);
+    switch (rng.below(4)) {
+    case 0:
+        if (at < input.size())
+            input[at] = rng.below(2) ? char(rng.next()) :
+                interesting[rng.below(sizeof(interesting) - 1)];
+        break;
+    case 1:
+        input.insert(at, 1, interesting[rng.below(sizeof(interesting) - 1)]);
+        break;
+    case 2:
+        input.erase(at, rng.below(8));
+        break;
+    default:
+        input.insert(at, input.substr(at, rng.below(32)));
+        break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned long iterations =
+        argc > 1 ? std::strtoul(argv[1], NULL, 10) : 200000;
+    prng rng(argc > 2 ? std::strtoull(argv[2], NULL, 10) : 0x5eed);
+
+    for (unsigned long i = 0; i < iterations; ++i) {
+        std::string input = seeds[rng.below(sizeof(seeds) / sizeof(seeds[0]))];
+        for (std::size_t edits = rng.below(6); edits; --edits)
+            mutate(input, rng);
+        if (!check_input(input.data(), input.size(), rng)) {
+            std::cout << "iteration " << i << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << iterations << " inputs parsed identically in pieces"
+              << std::endl;
+    return 0;
+}
+
+#endif
@@ -15,13 +15,23 @@
 #pragma once
 
 #include <string>
-#include <map>
 #include <vector>
 #include <sstream>
 #include <algorithm>
 #include <iostream>
+#include <functional>
+#include <streambuf>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <utility>
+
+#include <strings.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 
 #include "strings.hpp"
+#include "http_utils.hpp"
 
 #ifndef __HTTP_MESSAGE__H__
 #define __HTTP_MESSAGE__H__
@@ -32,48 +42,256 @@ namespace cxx_utils
     {
         namespace http
         {
+            /**
+             * @brief A single cookie, either a "name=value" pair from a
+             * Cookie header or a Set-Cookie line with its attributes.
+             *
+             * The name and value are located once, at construction, and kept
+             * as offsets into the cookie string; the accessors never split or
+             * tokenize again.
+             */
             class cookie
             {
                 std::string m_sCookieString;
+                std::size_t m_nNameStart;
+                std::size_t m_nNameLen;
+                std::size_t m_nValueStart;
+                std::size_t m_nValueLen;
+
+                void index()
+                {
+                    cxx_utils::string::string_ref whole(m_sCookieString);
+                    const char *semi = static_cast<const char *>
+                        (std::memchr(whole.data(), ';', whole.size()));
+                    cxx_utils::string::string_ref pair(whole.data(),
+                                                       semi ?
+                                                       semi - whole.data() :
+                                                       whole.size());
+                    const char *eq = static_cast<const char *>
+                        (std::memchr(pair.data(), '=', pair.size()));
+
+                    m_nNameStart = m_nNameLen = 0;
+                    m_nValueStart = m_nValueLen = 0;
+                    if (!eq)
+                        return;
+
+                    cxx_utils::string::string_ref name =
+                        cxx_utils::string::utils::trim_ref
+                        (cxx_utils::string::string_ref(pair.data(),
+                                                       eq - pair.data()));
+                    cxx_utils::string::string_ref val =
+                        cxx_utils::string::utils::trim_ref
+                        (cxx_utils::string::string_ref(eq + 1,
+                                                       pair.end() - (eq + 1)));
+                    m_nNameStart = name.data() - whole.data();
+                    m_nNameLen = name.size();
+                    m_nValueStart = val.data() - whole.data();
+                    m_nValueLen = val.size();
+                }
+
+                /// Finds the "; @attr=value" attribute (case-insensitive).
+                bool attribute(const char *attr,
+                               cxx_utils::string::string_ref &val) const
+                {
+                    const char *p = m_sCookieString.data();
+                    const char *end = p + m_sCookieString.size();
+                    const char *semi;
+                    while ((semi = static_cast<const char *>
+                            (std::memchr(p, ';', end - p))) != 0) {
+                        p = semi + 1;
+                        const char *stop = static_cast<const char *>
+                            (std::memchr(p, ';', end - p));
+                        if (!stop)
+                            stop = end;
+                        const char *eq = static_cast<const char *>
+                            (std::memchr(p, '=', stop - p));
+                        cxx_utils::string::string_ref name =
+                            cxx_utils::string::utils::trim_ref
+                            (cxx_utils::string::string_ref(p, (eq ? eq : stop)
+                                                           - p));
+                        if (cxx_utils::string::utils::iequals(name, attr)) {
+                            val = eq ? cxx_utils::string::utils::trim_ref
+                                (cxx_utils::string::string_ref
+                                 (eq + 1, stop - (eq + 1))) :
+                                cxx_utils::string::string_ref();
+                            return true;
+                        }
+                    }
+                    return false;
+                }
+
+                static bool parse_number(const char *&p, const char *end,
+                                         int &value, int maxdigits)
+                {
+                    const char *start = p;
+                    value = 0;
+                    while (p != end && isdigit(*p) && p - start < maxdigits)
+                        value = value * 10 + (*p++ - '0');
+                    return p != start;
+                }
+
+                /**
+                 * Parses the cookie date forms seen in the wild:
+                 * "Sun, 06 Nov 1994 08:49:37 GMT" (IMF-fixdate) and
+                 * "Sunday, 06-Nov-94 08:49:37 GMT" (RFC 850).
+                 */
+                static bool parse_date(const cxx_utils::string::string_ref &date,
+                                       time_t &when)
+                {
+                    static const char months[] =
+                        "janfebmaraprmayjunjulaugsepoctnovdec";
+                    const char *p = date.begin();
+                    const char *end = date.end();
+                    const char *comma = static_cast<const char *>
+                        (std::memchr(p, ',', end - p));
+                    if (comma)
+                        p = comma + 1;
+                    while (p != end && *p == ' ')
+                        ++p;
+
+                    struct tm tmval;
+                    std::memset(&tmval, 0, sizeof(tmval));
+                    int year;
+                    if (!parse_number(p, end, tmval.tm_mday, 2) ||
+                        end - p < 5 || (*p != ' ' && *p != '-'))
+                        return false;
+                    ++p;
+
+                    char mon[3];
+                    for (int i = 0; i < 3; ++i)
+                        mon[i] = char(::tolower((unsigned char)p[i]));
+                    tmval.tm_mon = -1;
+                    for (int m = 0; m < 12; ++m) {
+                        if (!std::memcmp(months + 3 * m, mon, 3))
+                            tmval.tm_mon = m;
+                    }
+                    p += 3;
+                    if (tmval.tm_mon < 0 || p == end ||
+                        (*p != ' ' && *p != '-'))
+                        return false;
+                    ++p;
+
+                    const char *yearstart = p;
+                    if (!parse_number(p, end, year, 4))
+                        return false;
+                    if (p - yearstart == 2)
+                        year += year < 70 ? 2000 : 1900;
+                    tmval.tm_year = year - 1900;
+
+                    while (p != end && *p == ' ')
+                        ++p;
+                    if (!parse_number(p, end, tmval.tm_hour, 2) ||
+                        p == end || *p++ != ':' ||
+                        !parse_number(p, end, tmval.tm_min, 2) ||
+                        p == end || *p++ != ':' ||
+                        !parse_number(p, end, tmval.tm_sec, 2))
+                        return false;
+
+                    when = timegm(&tmval);
+                    return when != time_t(-1);
+                }
+
             public:
 
                 cookie(const std::string &cookieName,
                        const std::string &cookieVal, timeval *exp = 0,
                        const char *domain = "") :
                     m_sCookieString(cookieName + "=" + cookieVal)
-                { }
+                {
+                    if (exp) {
+                        char date[date_cache::length];
+                        date_cache::render(exp->tv_sec, date);
+                        m_sCookieString += "; Expires=";
+                        m_sCookieString.append(date, sizeof(date));
+                    }
+                    if (domain && *domain) {
+                        m_sCookieString += "; Domain=";
+                        m_sCookieString += domain;
+                    }
+                    index();
+                }
 
                 cookie(const std::string &cookieStr) :
-                    m_sCookieString(cookieStr) {}
+                    m_sCookieString(cookieStr)
+                {
+                    index();
+                }
 
-                bool expiration(timeval &expTime) const { return false; }
-                bool domain(std::string &domain) const { return false; }
-                bool name(std::string &name) const
+                /**
+                 * When the cookie expires: Max-Age (relative to now) wins
+                 * over Expires, per RFC 6265. False for session cookies.
+                 */
+                bool expiration(timeval &expTime) const
                 {
-                    std::vector<std::string> nameval;
-                    cxx_utils::string::utils::tokenize(nameval,
-                                                       m_sCookieString, "= ");
-                    if (nameval.empty() || nameval.size() < 2) {
-                        return false;
+                    cxx_utils::string::string_ref attr;
+                    if (attribute("Max-Age", attr) && !attr.empty()) {
+                        const char *p = attr.begin();
+                        const bool negative = *p == '-';
+                        if (negative)
+                            ++p;
+                        long age = 0;
+                        for (; p != attr.end() && isdigit(*p) &&
+                                 age < 100000000000L; ++p)
+                            age = age * 10 + (*p - '0');
+                        if (p == attr.end()) {
+                            expTime.tv_sec = negative ? 0 : time(NULL) + age;
+                            expTime.tv_usec = 0;
+                            return true;
+                        }
+                    }
+
+                    time_t when;
+                    if (attribute("Expires", attr) && parse_date(attr, when)) {
+                        expTime.tv_sec = when;
+                        expTime.tv_usec = 0;
+                        return true;
                     }
+                    return false;
+                }
+
+                bool domain(std::string &domain) const
+                {
+                    cxx_utils::string::string_ref attr;
+                    if (!attribute("Domain", attr) || attr.empty())
+                        return false;
+                    if (attr[0] == '.')
+                        attr = cxx_utils::string::string_ref(attr.data() + 1,
+                                                             attr.size() - 1);
+                    domain.assign(attr.data(), attr.size());
+                    return true;
+                }
+
+                cxx_utils::string::string_ref name_ref() const
+                {
+                    return cxx_utils::string::string_ref
+                        (m_sCookieString.data() + m_nNameStart, m_nNameLen);
+                }
+
+                cxx_utils::string::string_ref value_ref() const
+                {
+                    return cxx_utils::string::string_ref
+                        (m_sCookieString.data() + m_nValueStart, m_nValueLen);
+                }
 
-                    name = nameval[0];
+                bool name(std::string &name) const
+                {
+                    if (!m_nNameLen)
+                        return false;
+                    name.assign(m_sCookieString, m_nNameStart, m_nNameLen);
                     return true;
                 }
 
                 bool value(std::string &val) const
                 {
-                    size_t pos = m_sCookieString.find_first_of("=", 0);
-                    if (pos == std::string::npos)
+                    if (!m_nNameLen)
                         return false;
-                    val = std::string(m_sCookieString.substr(pos+1));
+                    val.assign(m_sCookieString, m_nValueStart, m_nValueLen);
                     return true;
                 }
 
                 bool operator==(const std::string &cookieStr) const
                 {
-                    std::string myname;
-                    if (name(myname) && myname == cookieStr)
+                    if (m_nNameLen && name_ref() == cookieStr)
                         return true;
 
                     return m_sCookieString == cookieStr;
@@ -88,75 +306,1067 @@ namespace cxx_utils
             class http_message
             {
             public:
-                typedef std::map<std::string, std::string> headers;
-                typedef std::vector<cookie>                cookiejar;
+                /// A region of the message's raw header block.
+                struct field_view
+                {
+                    std::size_t offset;
+                    std::size_t length;
+                };
+
+                /**
+                 * Headers common enough to get a fixed slot in every message;
+                 * anything else lands in the extension header list.
+                 */
+                enum known_headers {
+                    hdr_host,
+                    hdr_date,
+                    hdr_accept,
+                    hdr_cookie,
+                    hdr_expect,
+                    hdr_server,
+                    hdr_referer,
+                    hdr_location,
+                    hdr_connection,
+                    hdr_keep_alive,
+                    hdr_set_cookie,
+                    hdr_user_agent,
+                    hdr_content_type,
+                    hdr_authorization,
+                    hdr_cache_control,
+                    hdr_content_length,
+                    hdr_accept_encoding,
+                    hdr_transfer_encoding,
+
+                    max_header
+                };
+
+                /// A header outside known_headers; both halves view the raw block.
+                struct extension_field
+                {
+                    field_view name;
+                    field_view value;
+                };
+
+                /* a flat list rather than a map: reset() clears it but keeps
+                 * its capacity, and a message rarely has more than a handful */
+                typedef std::vector<extension_field> extension_headers;
+
+                /// One name=value pair out of a Cookie header.
+                struct cookie_field
+                {
+                    field_view name;
+                    field_view value;
+                };
+
+                typedef std::vector<cookie_field> cookie_index;
+
+                /// Receives body bytes as they are decoded.
+                typedef std::function<void(const char *, std::size_t)>
+                    body_sink;
+
+                /// How the body following the header section is framed.
+                enum body_states {
+                    body_none,
+                    body_fixed,
+                    body_chunk_size,
+                    body_chunk_data,
+                    body_chunk_end,
+                    body_trailers,
+                    body_until_close,
+                    body_invalid
+                };
+
+                enum parse_status {
+                    parse_incomplete,
+                    parse_complete,
+                    parse_error
+                };
+
+                /**
+                 * Renders into a fixed caller buffer. Writes that do not fit
+                 * are dropped but still counted, so size() reports what the
+                 * whole rendering needs.
+                 */
+                class head_writer
+                {
+                    char        *m_out;
+                    std::size_t  m_cap;
+                    std::size_t  m_len;
+                public:
+                    head_writer(char *out, std::size_t cap) :
+                        m_out(out), m_cap(cap), m_len(0) {}
+
+                    void put(const char *data, std::size_t len)
+                    {
+                        if (m_len + len <= m_cap)
+                            std::memcpy(m_out + m_len, data, len);
+                        m_len += len;
+                    }
+
+                    void put(const cxx_utils::string::string_ref &ref)
+                    {
+                        put(ref.data(), ref.size());
+                    }
+
+                    void put(const char *str)
+                    {
+                        put(str, std::strlen(str));
+                    }
+
+                    void put_uint(std::uint64_t value)
+                    {
+                        char digits[20];
+                        std::size_t n = 0;
+                        do {
+                            digits[sizeof(digits) - ++n] =
+                                char('0' + value % 10);
+                            value /= 10;
+                        } while (value);
+                        put(digits + sizeof(digits) - n, n);
+                    }
+
+                    void put_cookies(const http_message &msg)
+                    {
+                        const cookie_index &idx = msg.cookies();
+                        if (idx.empty())
+                            return;
+                        put("Cookie: ", 8);
+                        for (std::size_t i = 0; i < idx.size(); ++i) {
+                            if (i)
+                                put("; ", 2);
+                            put(msg.view(idx[i].name));
+                            put("=", 1);
+                            put(msg.view(idx[i].value));
+                        }
+                        put("\r\n", 2);
+                    }
+
+                    void put_header(const cxx_utils::string::string_ref &name,
+                                    const cxx_utils::string::string_ref &val)
+                    {
+                        put(name);
+                        put(": ", 2);
+                        put(val);
+                        put("\r\n", 2);
+                    }
+
+                    /// A "Date:" header for @now, via the shared date_cache.
+                    void put_date(time_t now)
+                    {
+                        char date[date_cache::length];
+                        date_cache::instance().format(now, date);
+                        put("Date: ", 6);
+                        put(date, sizeof(date));
+                        put("\r\n", 2);
+                    }
+
+                    std::size_t size() const { return m_len; }
+                    bool fits() const { return m_len <= m_cap; }
+                };
+
+                /**
+                 * Bounds enforced while parsing, so a hostile peer cannot
+                 * make a message grow without limit. Each is checked as bytes
+                 * arrive, before they are buffered.
+                 */
+                struct parser_limits
+                {
+                    std::size_t max_start_line;    ///< request/status line
+                    std::size_t max_header_bytes;  ///< headers + trailers
+                    std::size_t max_header_count;
+                    std::size_t max_body;
+
+                    parser_limits() : max_start_line(8192),
+                                      max_header_bytes(65536),
+                                      max_header_count(100),
+                                      max_body(SIZE_MAX) {}
+                };
+
+                /// Why parsing stopped in its error state.
+                enum parse_errors {
+                    err_none,
+                    err_malformed,
+                    err_start_line_too_long,
+                    err_headers_too_large,
+                    err_too_many_headers,
+                    err_body_too_large
+                };
+
+                /// The outcome of a single feed() call.
+                struct feed_result
+                {
+                    std::size_t  consumed;
+                    parse_status status;
+                };
 
             protected:
                 std::int32_t     m_maj;
                 int              m_min;
-                headers          m_httphdrs;
-                cookiejar        m_cookies;
+                std::string      m_raw;
+                std::size_t      m_tokstart;
+                field_view       m_known[max_header];
+                extension_headers m_extra;
+                cookie_index     m_cookieidx;
+                std::vector<field_view> m_setcookies;
                 std::string      m_body;
-                std::string      m_accumulator;
+                std::size_t      m_bodyleft;
+                body_states      m_bodystate;
+                body_sink        m_sink;
+                parser_limits    m_limits;
+                parse_errors     m_error;
+                std::size_t      m_hdrbase;
+                std::size_t      m_hdrcount;
+                std::size_t      m_bodytotal;
+                cxx_utils::string::string_ref m_bodyref;  ///< see set_body_ref()
+                bool             m_bodyext;
+                std::string      m_accumulator;  ///< input for updated()
+
+                int fail(parse_errors error)
+                {
+                    m_error = error;
+                    return -1;
+                }
 
-                int parse_version()
+                /// Marks the end of the start line; headers begin here.
+                void begin_headers()
                 {
-                    m_accumulator =
-                        cxx_utils::string::utils::trim(m_accumulator,
-                                                       " \r\n\t");
-                    if (m_accumulator.empty() ||
-                        m_accumulator.substr(0, 5) != "HTTP/") {
+                    m_hdrbase = m_raw.size();
+                    m_hdrcount = 0;
+                }
+
+                /// The raw block size the header section may grow to.
+                std::size_t header_cap() const
+                {
+                    return m_limits.max_header_bytes > SIZE_MAX - m_hdrbase ?
+                        SIZE_MAX : m_hdrbase + m_limits.max_header_bytes;
+                }
+
+                field_view to_field(const cxx_utils::string::string_ref &ref)
+                    const
+                {
+                    field_view field;
+                    field.offset = ref.data() - m_raw.data();
+                    field.length = ref.size();
+                    return field;
+                }
+
+                /**
+                 * Splits a Cookie header value ("a=1; b=2") already held in
+                 * the raw block into the cookie index; no copies are made.
+                 */
+                void index_cookies(const field_view &header)
+                {
+                    cxx_utils::string::string_ref text = view(header);
+                    const char *p = text.begin();
+                    while (p < text.end()) {
+                        const char *semi = static_cast<const char *>
+                            (std::memchr(p, ';', text.end() - p));
+                        const char *stop = semi ? semi : text.end();
+                        const char *eq = static_cast<const char *>
+                            (std::memchr(p, '=', stop - p));
+                        if (eq) {
+                            cookie_field field;
+                            field.name = to_field
+                                (cxx_utils::string::utils::trim_ref
+                                 (cxx_utils::string::string_ref(p, eq - p)));
+                            field.value = to_field
+                                (cxx_utils::string::utils::trim_ref
+                                 (cxx_utils::string::string_ref
+                                  (eq + 1, stop - (eq + 1))));
+                            if (field.name.length)
+                                m_cookieidx.push_back(field);
+                        }
+                        p = stop + 1;
+                    }
+                }
+
+                /**
+                 * Appends the bytes of [p, end) up to and including @delim to
+                 * the raw header block, advancing @p past them, but never
+                 * lets the block grow beyond @cap bytes. Returns 1 when
+                 * @delim was found, meaning the current token spans
+                 * [m_tokstart, m_raw.size()), 0 when more input is needed,
+                 * and -1 when the token cannot end within @cap.
+                 */
+                int scan_token(const char *&p, const char *end, char delim,
+                               std::size_t cap = SIZE_MAX)
+                {
+                    const std::size_t room =
+                        cap > m_raw.size() ? cap - m_raw.size() : 0;
+                    const std::size_t window =
+                        std::min<std::size_t>(end - p, room);
+                    const char *hit = static_cast<const char *>
+                        (std::memchr(p, delim, window));
+                    const char *stop = hit ? hit + 1 : p + window;
+                    m_raw.append(p, stop - p);
+                    p = stop;
+                    if (hit)
+                        return 1;
+                    return p == end ? 0 : -1;
+                }
+
+                /**
+                 * Returns the current token with @spaces trimmed from either
+                 * end, and starts a new token.
+                 */
+                field_view take_token(const char *spaces)
+                {
+                    cxx_utils::string::string_ref tok =
+                        cxx_utils::string::utils::trim_ref
+                        (cxx_utils::string::string_ref(m_raw.data() +
+                                                       m_tokstart,
+                                                       m_raw.size() -
+                                                       m_tokstart), spaces);
+                    field_view result;
+                    result.offset = tok.data() - m_raw.data();
+                    result.length = tok.size();
+                    m_tokstart = m_raw.size();
+                    return result;
+                }
+
+                int parse_version(const field_view &tok)
+                {
+                    cxx_utils::string::string_ref data = view(tok);
+                    if (data.size() < 8 ||
+                        std::memcmp(data.data(), "HTTP/", 5)) {
                         return -1;
                     }
 
-                    std::string data=m_accumulator.substr(5,
-                                                          std::string::npos);
-                    m_accumulator.clear();
-                    try {
-                        m_maj = std::stoi(
-                            data.substr(0, data.find_first_of(".")));
-                        m_min = std::stoi(
-                            data.substr(data.find_first_of(".")+1,
-                                        std::string::npos));
-                        return 0;
-                    } catch (std::invalid_argument &e) {
+                    std::size_t pos = 5;
+                    std::int32_t maj = 0;
+                    int min = 0;
+                    const std::size_t majstart = pos;
+                    while (pos < data.size() && isdigit(data[pos]) &&
+                           pos - majstart < 4)
+                        maj = maj * 10 + (data[pos++] - '0');
+                    if (pos == majstart || pos == data.size() ||
+                        data[pos++] != '.')
                         return -1;
+
+                    const std::size_t minstart = pos;
+                    while (pos < data.size() && isdigit(data[pos]) &&
+                           pos - minstart < 4)
+                        min = min * 10 + (data[pos++] - '0');
+                    if (pos == minstart || pos != data.size())
+                        return -1;
+
+                    m_maj = maj;
+                    m_min = min;
+                    return 0;
+                }
+
+                /**
+                 * Handles one complete header line (the current token).
+                 * Returns 1 when the line was the blank line ending the
+                 * header section, -1 once there are too many headers, and 0
+                 * otherwise. A chunked @bTrailer line naming a framing or
+                 * routing field (Host, Connection, Content-Length,
+                 * Transfer-Encoding) is malformed (-1): it would overwrite
+                 * the value the body was framed by.
+                 */
+                int header_line(bool bTrailer = false)
+                {
+                    const std::size_t linelen = m_raw.size() - m_tokstart;
+                    if (linelen == 1 ||
+                        (linelen == 2 && m_raw[m_tokstart] == '\r')) {
+                        m_tokstart = m_raw.size();
+                        return 1;
+                    }
+
+                    if (++m_hdrcount > m_limits.max_header_count)
+                        return fail(err_too_many_headers);
+
+                    field_view line = take_token(" \r\n\t");
+                    cxx_utils::string::string_ref text = view(line);
+                    const char *colon = static_cast<const char *>
+                        (std::memchr(text.data(), ':', text.size()));
+                    if (!colon) {
+                        return 0;
+                    }
+
+                    cxx_utils::string::string_ref name =
+                        cxx_utils::string::utils::trim_ref
+                        (cxx_utils::string::string_ref(text.data(),
+                                                       colon - text.data()));
+                    cxx_utils::string::string_ref value =
+                        cxx_utils::string::utils::trim_ref
+                        (cxx_utils::string::string_ref(colon + 1,
+                                                       text.end() -
+                                                       (colon + 1)));
+                    field_view field;
+                    field.offset = value.data() - m_raw.data();
+                    field.length = value.size();
+
+                    known_headers hdr = classify_header(name);
+                    if (bTrailer &&
+                        (hdr == hdr_host || hdr == hdr_connection ||
+                         hdr == hdr_content_length ||
+                         hdr == hdr_transfer_encoding))
+                        return fail(err_malformed);
+                    if (hdr == hdr_cookie) {
+                        index_cookies(field);
+                    } else if (hdr == hdr_set_cookie) {
+                        m_setcookies.push_back(field);
+                    } else if (hdr != max_header) {
+                        m_known[hdr] = field;
+                    } else {
+                        std::size_t i = find_extra(name);
+                        if (i != m_extra.size()) {
+                            m_extra[i].value = field;
+                        } else {
+                            extension_field extra;
+                            extra.name.offset = name.data() - m_raw.data();
+                            extra.name.length = name.size();
+                            extra.value = field;
+                            m_extra.push_back(extra);
+                        }
                     }
+                    return 0;
+                }
+
+                /**
+                 * Called once the header section is complete; decides how the
+                 * body is framed, parsing Content-Length exactly once. A
+                 * message with neither Transfer-Encoding nor Content-Length
+                 * reports body_none; whether that means "no body" or "read
+                 * until close" is up to the caller. A Content-Length over the
+                 * body limit is refused here, before any of it is read.
+                 */
+                body_states header_done()
+                {
+                    cxx_utils::string::string_ref hdr;
+                    m_bodyleft = 0;
+
+                    if (get_header(hdr_transfer_encoding, hdr)) {
+                        // chunked must be the final coding applied
+                        const char *comma = hdr.end();
+                        while (comma != hdr.begin() && *(comma - 1) != ',')
+                            --comma;
+                        cxx_utils::string::string_ref last =
+                            cxx_utils::string::utils::trim_ref
+                            (cxx_utils::string::string_ref
+                             (comma, hdr.end() - comma));
+                        m_bodystate =
+                            cxx_utils::string::utils::iequals(last,
+                                                              "chunked") ?
+                            body_chunk_size : body_until_close;
+                        return m_bodystate;
+                    }
+
+                    m_bodystate = body_none;
+                    if (!get_header(hdr_content_length, hdr) || hdr.empty())
+                        return m_bodystate;
+
+                    for (std::size_t i = 0; i < hdr.size(); ++i) {
+                        if (!isdigit(hdr[i]) ||
+                            m_bodyleft > (SIZE_MAX - 9) / 10) {
+                            fail(err_malformed);
+                            return m_bodystate = body_invalid;
+                        }
+                        m_bodyleft = m_bodyleft * 10 + (hdr[i] - '0');
+                    }
+                    if (m_bodyleft > m_limits.max_body) {
+                        fail(err_body_too_large);
+                        return m_bodystate = body_invalid;
+                    }
+                    m_bodystate = m_bodyleft ? body_fixed : body_none;
+                    return m_bodystate;
+                }
+
+                void deliver_body(const char *data, std::size_t len)
+                {
+                    if (m_sink)
+                        m_sink(data, len);
+                    else
+                        m_body.append(data, len);
+                }
+
+                /**
+                 * Drops the current token from the raw header block, so that
+                 * chunk framing does not accumulate across a long body.
+                 */
+                void discard_token()
+                {
+                    m_raw.resize(m_tokstart);
+                }
+
+                int chunk_size_line()
+                {
+                    cxx_utils::string::string_ref line =
+                        cxx_utils::string::utils::trim_ref
+                        (cxx_utils::string::string_ref(m_raw.data() +
+                                                       m_tokstart,
+                                                       m_raw.size() -
+                                                       m_tokstart),
+                         " \t\r\n");
+
+                    std::size_t size = 0, i = 0;
+                    for (; i < line.size(); ++i) {
+                        const int c = ::tolower((unsigned char)line[i]);
+                        int digit;
+                        if (c >= '0' && c <= '9')
+                            digit = c - '0';
+                        else if (c >= 'a' && c <= 'f')
+                            digit = c - 'a' + 10;
+                        else
+                            break;
+                        if (size > (SIZE_MAX >> 4))
+                            return fail(err_body_too_large);
+                        size = (size << 4) | digit;
+                    }
+                    // chunk extensions (";name=value") are ignored
+                    const bool valid = i != 0 &&
+                        (i == line.size() || line[i] == ';' ||
+                         line[i] == ' ' || line[i] == '\t');
+                    discard_token();
+                    if (!valid)
+                        return fail(err_malformed);
+                    if (size > m_limits.max_body - m_bodytotal)
+                        return fail(err_body_too_large);
+
+                    m_bodytotal += size;
+                    m_bodyleft = size;
+                    m_bodystate = size ? body_chunk_data : body_trailers;
+                    return 0;
+                }
+
+                /**
+                 * Decodes body bytes from [p, end) according to m_bodystate,
+                 * handing them to the body sink (or m_body when there is no
+                 * sink). Returns 1 once the body is complete, -1 on a framing
+                 * error, and 0 when more input is needed.
+                 */
+                int feed_body(const char *&p, const char *end)
+                {
+                    while (p != end) {
+                        switch (m_bodystate) {
+                        case body_fixed:
+                        case body_chunk_data:
+                        {
+                            std::size_t n =
+                                std::min<std::size_t>(end - p, m_bodyleft);
+                            deliver_body(p, n);
+                            p += n;
+                            m_bodyleft -= n;
+                            if (m_bodyleft)
+                                break;
+                            if (m_bodystate == body_fixed) {
+                                m_bodystate = body_none;
+                                return 1;
+                            }
+                            m_bodystate = body_chunk_end;
+                            break;
+                        }
+                        case body_until_close:
+                        {
+                            const std::size_t n = end - p;
+                            if (n > m_limits.max_body - m_bodytotal)
+                                return fail(err_body_too_large);
+                            m_bodytotal += n;
+                            deliver_body(p, n);
+                            p = end;
+                            break;
+                        }
+                        case body_chunk_size:
+                            switch (scan_token(p, end, '\n', header_cap())) {
+                            case -1:
+                                return fail(err_headers_too_large);
+                            case 0:
+                                continue;
+                            }
+                            if (chunk_size_line() < 0)
+                                return -1;
+                            break;
+                        case body_chunk_end:
+                        {
+                            switch (scan_token(p, end, '\n', header_cap())) {
+                            case -1:
+                                return fail(err_headers_too_large);
+                            case 0:
+                                continue;
+                            }
+                            const std::size_t linelen =
+                                m_raw.size() - m_tokstart;
+                            const bool blank = linelen == 1 ||
+                                (linelen == 2 &&
+                                 m_raw[m_tokstart] == '\r');
+                            discard_token();
+                            if (!blank)
+                                return fail(err_malformed);
+                            m_bodystate = body_chunk_size;
+                            break;
+                        }
+                        case body_trailers:
+                            switch (scan_token(p, end, '\n', header_cap())) {
+                            case -1:
+                                return fail(err_headers_too_large);
+                            case 0:
+                                continue;
+                            }
+                            switch (header_line(true)) {
+                            case 1:
+                                m_bodystate = body_none;
+                                return 1;
+                            case -1:
+                                return -1;
+                            }
+                            break;
+                        default:
+                            return m_bodystate == body_none ? 1 :
+                                fail(err_malformed);
+                        }
+                    }
+                    return 0;
+                }
+
+                /// Clears all per-message state, keeping buffer capacity.
+                void reset_message()
+                {
+                    m_maj = 1;
+                    m_min = 1;
+                    m_raw.clear();
+                    m_tokstart = 0;
+                    for (int i = 0; i < max_header; ++i) {
+                        m_known[i].offset = std::string::npos;
+                        m_known[i].length = 0;
+                    }
+                    m_extra.clear();
+                    m_cookieidx.clear();
+                    m_setcookies.clear();
+                    m_body.clear();
+                    m_bodyref = cxx_utils::string::string_ref();
+                    m_bodyext = false;
+                    m_bodyleft = 0;
+                    m_bodystate = body_none;
+                    m_error = err_none;
+                    m_hdrbase = 0;
+                    m_hdrcount = 0;
+                    m_bodytotal = 0;
+                }
+
+                field_view add_value(const std::string &val)
+                {
+                    field_view field;
+                    field.offset = m_raw.size();
+                    field.length = val.size();
+                    m_raw += val;
+                    m_tokstart = m_raw.size();
+                    return field;
+                }
+
+                /// Index of the extension header @name, or m_extra.size().
+                std::size_t find_extra(const cxx_utils::string::string_ref &name) const
+                {
+                    std::size_t i = 0;
+                    for (; i < m_extra.size(); ++i)
+                        if (cxx_utils::string::utils::iequals(view(m_extra[i].name),
+                                                              name))
+                            break;
+                    return i;
+                }
+
+                static bool present(const field_view &field)
+                {
+                    return field.offset != std::string::npos;
                 }
 
             public:
                 http_message(std::uint32_t major=1, std::uint32_t minor=1):
-                    m_maj(major), m_min(minor), m_httphdrs(), m_cookies(),
-                    m_body(), m_accumulator(){}
+                    m_maj(major), m_min(minor), m_raw(), m_tokstart(0),
+                    m_extra(), m_cookieidx(), m_setcookies(), m_body(), m_bodyleft(0),
+                    m_bodystate(body_none), m_sink(), m_limits(),
+                    m_error(err_none), m_hdrbase(0), m_hdrcount(0),
+                    m_bodytotal(0), m_bodyref(), m_bodyext(false)
+                {
+                    for (int i = 0; i < max_header; ++i) {
+                        m_known[i].offset = std::string::npos;
+                        m_known[i].length = 0;
+                    }
+                }
                 virtual ~http_message(){}
 
-                virtual void updated() = 0;
+                /**
+                 * Parses @len bytes from @buf, scanning whole runs at a time
+                 * rather than a character per call. Bytes are copied at most
+                 * once (in bulk) into the raw header block, so the caller may
+                 * reuse @buf as soon as feed() returns.
+                 */
+                virtual feed_result feed(const char *buf, std::size_t len) = 0;
+
+                /**
+                 * The pre-feed() entry point, kept for callers that append
+                 * to m_accumulator and then call updated(): parses whatever
+                 * has accumulated and drops the bytes feed() consumed.
+                 */
+                virtual void updated()
+                {
+                    feed_result res = feed(m_accumulator.data(),
+                                           m_accumulator.size());
+                    m_accumulator.erase(0, res.consumed);
+                }
+
+                /**
+                 * Renders the start line and headers into @buf, returning
+                 * the number of bytes the head needs; nothing useful is in
+                 * @buf unless that is <= @len.
+                 */
+                virtual std::size_t serialize_head(char *buf,
+                                                   std::size_t len) const = 0;
+
+                virtual std::string serialize() const
+                {
+                    char head[512];
+                    std::size_t len = serialize_head(head, sizeof(head));
+                    std::string result;
+                    const cxx_utils::string::string_ref body = wire_body();
+                    if (len <= sizeof(head)) {
+                        result.reserve(len + body.size());
+                        result.assign(head, len);
+                    } else {
+                        result.resize(len);
+                        serialize_head(&result[0], len);
+                    }
+                    result.append(body.data(), body.size());
+                    return result;
+                }
+
+                /**
+                 * Renders the whole message (head and body) into @buf.
+                 * Returns the total size; the output is only complete when
+                 * that is <= @len.
+                 */
+                std::size_t serialize(char *buf, std::size_t len) const
+                {
+                    const cxx_utils::string::string_ref body = wire_body();
+                    std::size_t head = serialize_head(buf, len);
+                    if (head <= len && body.size() <= len - head)
+                        std::memcpy(buf + head, body.data(), body.size());
+                    return head + body.size();
+                }
+
+                /**
+                 * Scatter-gather form: the head is rendered into @head and
+                 * the body is referenced in place. Fills up to two entries of
+                 * @iov and returns how many were used, or 0 when @headlen is
+                 * too small for the head.
+                 */
+                int serialize(struct iovec *iov, char *head,
+                              std::size_t headlen) const
+                {
+                    std::size_t used = serialize_head(head, headlen);
+                    if (used > headlen)
+                        return 0;
+
+                    const cxx_utils::string::string_ref body = wire_body();
+                    iov[0].iov_base = head;
+                    iov[0].iov_len = used;
+                    if (body.empty())
+                        return 1;
+                    iov[1].iov_base = const_cast<char *>(body.data());
+                    iov[1].iov_len = body.size();
+                    return 2;
+                }
+
+                /**
+                 * Replaces @iov with the segments making up this message,
+                 * ready for writev()/sendmsg(). The head is rendered into
+                 * @headbuf, which is grown only when needed so a buffer kept
+                 * per connection stops allocating after the first message;
+                 * the body is referenced in place and never copied. Both
+                 * must outlive the write. Returns the total byte count.
+                 */
+                std::size_t serialize(std::vector<struct iovec> &iov,
+                                      std::string &headbuf) const
+                {
+                    if (headbuf.size() < headbuf.capacity())
+                        headbuf.resize(headbuf.capacity());
+                    std::size_t used = serialize_head(&headbuf[0],
+                                                      headbuf.size());
+                    if (used > headbuf.size()) {
+                        headbuf.resize(used);
+                        serialize_head(&headbuf[0], used);
+                    }
+
+                    iov.clear();
+                    struct iovec seg;
+                    seg.iov_base = &headbuf[0];
+                    seg.iov_len = used;
+                    iov.push_back(seg);
+                    const cxx_utils::string::string_ref body = wire_body();
+                    if (!body.empty()) {
+                        seg.iov_base = const_cast<char *>(body.data());
+                        seg.iov_len = body.size();
+                        iov.push_back(seg);
+                    }
+                    return used + body.size();
+                }
+
+                /// Limits apply from the next byte fed; reset() keeps them.
+                void set_limits(const parser_limits &limits)
+                {
+                    m_limits = limits;
+                }
+
+                const parser_limits &limits() const { return m_limits; }
 
-                virtual std::string serialize() const = 0; 
+                /// The reason for the last parse_error, if any.
+                parse_errors error() const { return m_error; }
 
+                /// The accumulated body; stays empty while a sink is set.
                 const std::string &body() const { return m_body; }
 
-                bool get_header(const std::string &hdr, std::string &val) const
+                void set_body(const std::string &body)
+                {
+                    m_body = body;
+                    m_bodyext = false;
+                }
+
+                /// Takes over @body's buffer instead of copying it.
+                void set_body(std::string &&body)
+                {
+                    m_body = std::move(body);
+                    m_bodyext = false;
+                }
+
+                /**
+                 * Sends @len bytes at @data as the body without copying or
+                 * owning them; they must stay valid until the message is
+                 * serialized and written (the iovec forms point at them
+                 * directly). body() stays empty; wire_body() reports it.
+                 * set_body() or reset() drops the reference.
+                 */
+                void set_body_ref(const char *data, std::size_t len)
+                {
+                    m_body.clear();
+                    m_bodyref = cxx_utils::string::string_ref(data, len);
+                    m_bodyext = true;
+                }
+
+                /// The body as it will be serialized: owned or referenced.
+                cxx_utils::string::string_ref wire_body() const
+                {
+                    return m_bodyext ? m_bodyref :
+                        cxx_utils::string::string_ref(m_body);
+                }
+
+                /**
+                 * Streams the body to @sink as it is decoded instead of
+                 * accumulating it in body(). Chunk framing is stripped, so a
+                 * chunked upload reaches the sink as plain payload bytes and
+                 * the parser holds only the current framing line in memory.
+                 */
+                void set_body_sink(const body_sink &sink)
+                {
+                    m_sink = sink;
+                }
+
+                /// As above, writing the body into @sb.
+                void set_body_sink(std::streambuf *sb)
+                {
+                    if (!sb) {
+                        m_sink = body_sink();
+                        return;
+                    }
+                    m_sink = [sb](const char *data, std::size_t len) {
+                        sb->sputn(data, len);
+                    };
+                }
+
+                /// The canonical spelling of a known header.
+                static const char *header_name(known_headers hdr)
+                {
+                    static const char *const names[max_header] = {
+                        "Host", "Date", "Accept", "Cookie", "Expect",
+                        "Server", "Referer", "Location", "Connection",
+                        "Keep-Alive", "Set-Cookie", "User-Agent",
+                        "Content-Type", "Authorization", "Cache-Control",
+                        "Content-Length", "Accept-Encoding",
+                        "Transfer-Encoding"
+                    };
+                    return hdr < max_header ? names[hdr] : 0;
+                }
+
+                /**
+                 * Maps a header name onto its known_headers slot without
+                 * allocating. The (length, first letter) pair is a perfect
+                 * hash over the table, so at most one iequals() is needed.
+                 * Returns max_header for names outside the table.
+                 */
+                static known_headers
+                classify_header(const cxx_utils::string::string_ref &name)
                 {
-                    for( headers::const_iterator it = m_httphdrs.cbegin();
-                         it != m_httphdrs.cend(); ++it ) {
-                        if( cxx_utils::string::utils::istringcmp(it->first,
-                                                                 hdr) ) {
-                            val = it->second;
+                    if (name.empty())
+                        return max_header;
+
+                    known_headers hdr = max_header;
+                    const char first = ::tolower((unsigned char)name[0]);
+                    switch (name.size()) {
+                    case 4:
+                        hdr = first == 'h' ? hdr_host :
+                            first == 'd' ? hdr_date : max_header;
+                        break;
+                    case 6:
+                        hdr = first == 'a' ? hdr_accept :
+                            first == 'c' ? hdr_cookie :
+                            first == 'e' ? hdr_expect :
+                            first == 's' ? hdr_server : max_header;
+                        break;
+                    case 7:
+                        hdr = hdr_referer;
+                        break;
+                    case 8:
+                        hdr = hdr_location;
+                        break;
+                    case 10:
+                        hdr = first == 'c' ? hdr_connection :
+                            first == 'k' ? hdr_keep_alive :
+                            first == 's' ? hdr_set_cookie :
+                            first == 'u' ? hdr_user_agent : max_header;
+                        break;
+                    case 12:
+                        hdr = hdr_content_type;
+                        break;
+                    case 13:
+                        hdr = first == 'a' ? hdr_authorization :
+                            first == 'c' ? hdr_cache_control : max_header;
+                        break;
+                    case 14:
+                        hdr = hdr_content_length;
+                        break;
+                    case 15:
+                        hdr = hdr_accept_encoding;
+                        break;
+                    case 17:
+                        hdr = hdr_transfer_encoding;
+                        break;
+                    }
+
+                    if (hdr != max_header &&
+                        !cxx_utils::string::utils::iequals(name,
+                                                           header_name(hdr)))
+                        hdr = max_header;
+                    return hdr;
+                }
+
+                /// Resolves a view into the message's raw header block.
+                cxx_utils::string::string_ref view(const field_view &v) const
+                {
+                    return cxx_utils::string::string_ref(m_raw.data() +
+                                                         v.offset, v.length);
+                }
+
+                /// Every name=value pair from the Cookie header(s).
+                const cookie_index &cookies() const { return m_cookieidx; }
+
+                /**
+                 * Finds the cookie called @name; @value refers into the
+                 * message. Only the index built while parsing is consulted,
+                 * so lookups neither split nor allocate.
+                 */
+                bool find_cookie(const cxx_utils::string::string_ref &name,
+                                 cxx_utils::string::string_ref &value) const
+                {
+                    for (cookie_index::const_iterator it = m_cookieidx.begin();
+                         it != m_cookieidx.end(); ++it) {
+                        if (view(it->name) == name) {
+                            value = view(it->value);
                             return true;
                         }
                     }
                     return false;
                 }
 
+                /// Adds a name=value pair to the Cookie header.
+                void add_cookie(const std::string &name,
+                                const std::string &value)
+                {
+                    cookie_field field;
+                    field.name = add_value(name);
+                    field.value = add_value(value);
+                    m_cookieidx.push_back(field);
+                }
+
+                std::size_t set_cookie_count() const
+                {
+                    return m_setcookies.size();
+                }
+
+                /// The @i'th Set-Cookie line, with its attributes.
+                cookie set_cookie(std::size_t i) const
+                {
+                    return cookie(view(m_setcookies[i]).str());
+                }
+
+                void add_set_cookie(const cookie &c)
+                {
+                    m_setcookies.push_back(add_value(c.value()));
+                }
+
+                bool get_header(known_headers hdr,
+                                cxx_utils::string::string_ref &val) const
+                {
+                    if (hdr >= max_header || !present(m_known[hdr]))
+                        return false;
+                    val = view(m_known[hdr]);
+                    return true;
+                }
+
+                /**
+                 * Zero-copy header lookup; @val refers into the message and
+                 * is valid until the message is next modified.
+                 */
+                bool get_header(const cxx_utils::string::string_ref &hdr,
+                                cxx_utils::string::string_ref &val) const
+                {
+                    known_headers known = classify_header(hdr);
+                    if (known != max_header)
+                        return get_header(known, val);
+
+                    std::size_t i = find_extra(hdr);
+                    if (i == m_extra.size())
+                        return false;
+                    val = view(m_extra[i].value);
+                    return true;
+                }
+
+                bool get_header(const std::string &hdr, std::string &val) const
+                {
+                    cxx_utils::string::string_ref ref;
+                    if (!get_header(cxx_utils::string::string_ref(hdr), ref))
+                        return false;
+                    val.assign(ref.data(), ref.size());
+                    return true;
+                }
+
                 bool get_header(const char *hdr, std::string &val) const
                 {
                     return get_header(std::string(hdr), val);
                 }
 
+                /**
+                 * Sets (or replaces) a header. Must not be called while a
+                 * message is only partially fed, as the value is appended to
+                 * the raw header block.
+                 */
                 void set_header(const std::string &hdr, const std::string &val)
                 {
-                    m_httphdrs[hdr] = val;
+                    known_headers known = classify_header(hdr);
+                    if (known == hdr_cookie) {
+                        m_cookieidx.clear();
+                        index_cookies(add_value(val));
+                    } else if (known == hdr_set_cookie) {
+                        m_setcookies.assign(1, add_value(val));
+                    } else if (known != max_header)
+                        m_known[known] = add_value(val);
+                    else {
+                        std::size_t i = find_extra(hdr);
+                        if (i == m_extra.size()) {
+                            extension_field extra;
+                            extra.name = add_value(hdr);
+                            m_extra.push_back(extra);
+                        }
+                        m_extra[i].value = add_value(val);
+                    }
                 }
 
                 void set_header(const char *hdr, const char *val)
@@ -167,10 +1377,12 @@ namespace cxx_utils
                 virtual
                 http_message &operator<<(const std::string &rhs)
                 {
-                    size_t endpos = rhs.size();
-                    for(size_t pos = 0; pos < endpos; ++pos) {
-                        m_accumulator += rhs[pos];
-                        updated();
+                    feed_result res = feed(rhs.data(), rhs.size());
+                    if (res.consumed < rhs.size()) {
+                        // a stream has nowhere to hand back the excess, so
+                        // let the message reject it as it always has
+                        feed(rhs.data() + res.consumed,
+                             rhs.size() - res.consumed);
                     }
                     return *this;
                 }
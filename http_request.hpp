@@ -40,36 +40,103 @@ namespace cxx_utils
                 http_response::codes m_suggestedcode;
                 methods        m_curmethod;
                 parsing_states m_curstate;
-                std::string    m_uri;
+                field_view     m_uri;
                 char           m_nextbreaktok;
 
-                void update_method()
+                static const char *method_name(methods method)
                 {
-                    m_accumulator =
-                        cxx_utils::string::utils::trim(m_accumulator);
+                    static const char *const names[max_method] = {
+                        "GET", "POST", "PUT", "DELETE", "HEAD", "OPTIONS",
+                        "TRACE"
+                    };
+                    return method < max_method ? names[method] : 0;
+                }
 
-                    if (m_accumulator.size() > 10) {
-                        m_curmethod = max_method;
+                /**
+                 * Maps a request-line token onto a method. Switching on the
+                 * length (and the first letter where two methods share one)
+                 * leaves a single memcmp per token.
+                 */
+                static methods
+                classify_method(const cxx_utils::string::string_ref &tok)
+                {
+                    methods method = max_method;
+                    switch (tok.size()) {
+                    case 3:
+                        method = tok[0] == 'G' ? get_method :
+                            tok[0] == 'P' ? put_method : max_method;
+                        break;
+                    case 4:
+                        method = tok[0] == 'P' ? post_method :
+                            tok[0] == 'H' ? head_method : max_method;
+                        break;
+                    case 5:
+                        method = trace_method;
+                        break;
+                    case 6:
+                        method = delete_method;
+                        break;
+                    case 7:
+                        method = options_method;
+                        break;
                     }
 
-                    // XXX: use a std::map for this mapping
-                    else if (m_accumulator == "GET") {
-                        m_curmethod = get_method;
-                    } else if (m_accumulator == "PUT") {
-                        m_curmethod = put_method;
-                    } else if (m_accumulator == "POST") {
-                        m_curmethod = post_method;
-                    } else if (m_accumulator == "DELETE") {
-                        m_curmethod = delete_method;
-                    } else if (m_accumulator == "HEAD") {
-                        m_curmethod = head_method;
-                    } else if (m_accumulator == "OPTIONS") {
-                        m_curmethod = options_method;
-                    } else if (m_accumulator == "TRACE") {
-                        m_curmethod = trace_method;
-                    } else {
-                        m_curmethod = max_method;
+                    if (method != max_method &&
+                        std::memcmp(tok.data(), method_name(method),
+                                    tok.size()))
+                        method = max_method;
+                    return method;
+                }
+
+                /// No method we know of is longer than this.
+                static const std::size_t max_method_length = 16;
+
+                /// How far the raw block may grow while scanning this state.
+                std::size_t token_cap() const
+                {
+                    switch (m_curstate) {
+                    case parsing_method:
+                        return std::min(max_method_length,
+                                        m_limits.max_start_line);
+                    case parsing_uri:
+                    case parsing_version:
+                        return m_limits.max_start_line;
+                    default:
+                        return header_cap();
                     }
+                }
+
+                /// Moves to the error state with the status matching m_error.
+                void reject()
+                {
+                    switch (m_error) {
+                    case err_start_line_too_long:
+                        m_suggestedcode = m_curstate == parsing_method ?
+                            http_response::not_implemented :
+                            http_response::request_uri_too_large;
+                        break;
+                    case err_headers_too_large:
+                    case err_too_many_headers:
+                        m_suggestedcode =
+                            http_response::request_header_fields_too_large;
+                        break;
+                    case err_body_too_large:
+                        m_suggestedcode =
+                            http_response::request_entity_too_large;
+                        break;
+                    default:
+                        m_suggestedcode = http_response::bad_request;
+                        break;
+                    }
+                    m_curstate = parsing_err;
+                }
+
+                void update_method()
+                {
+                    cxx_utils::string::string_ref tok =
+                        view(take_token(" \t"));
+
+                    m_curmethod = classify_method(tok);
 
                     if (m_curmethod != max_method) {
                         m_curstate = parsing_uri;
@@ -77,84 +144,60 @@ namespace cxx_utils
                         m_curstate = parsing_err;
                         m_suggestedcode = http_response::not_implemented;
                     }
-
-                    m_accumulator.clear();
                 }
                 void update_uri()
                 {
-                    m_accumulator =
-                        cxx_utils::string::utils::trim(m_accumulator);
-                    if (m_accumulator.size() == 0)
+                    const std::size_t tokstart = m_tokstart;
+                    field_view uri = take_token(" \t");
+                    if (uri.length == 0) {
+                        m_tokstart = tokstart;
                         return;
+                    }
 
-                    m_uri = (m_accumulator);
-                    m_accumulator.clear();
+                    m_uri = uri;
                     m_curstate = parsing_version;
                     m_nextbreaktok = '\n';
                 }
                 void update_version()
                 {
-                    if ( parse_version() < 0 ) {
+                    if ( parse_version(take_token(" \r\n\t")) < 0 ) {
                         m_suggestedcode =
                             http_response::http_version_not_supported;
                         m_curstate = parsing_err;
-                    } else
+                    } else {
                         m_curstate = parsing_headers;
+                        begin_headers();
+                    }
                 }
                 void update_headers()
                 {
-                    if( m_accumulator == "\r\n" || m_accumulator == "\n" ){
-                        //This case indicates completed header
-                        std::string headerlen;
-                        m_accumulator.clear();
-                        if (!get_header(std::string("Content-length"),
-                                        headerlen) ||
-                            headerlen.empty()) {
-                            m_curstate = parsing_done;
-                        } else {
-                            m_curstate = parsing_body;
-                        }
+                    switch (header_line()) {
+                    case 0:
                         return;
-                    }
-
-                    m_accumulator =
-                        cxx_utils::string::utils::trim(m_accumulator, " \r\n\t");
-
-                    size_t coldelim = m_accumulator.find_first_of(":");
-
-                    if (coldelim == std::string::npos) {
+                    case -1:
+                        reject();
                         return;
                     }
 
-                    if (cxx_utils::string::utils::istringcmp
-                        (m_accumulator.substr(0, coldelim),
-                         std::string("Cookie"))) {
-                        cookie c(m_accumulator.substr(coldelim+1,
-                                                      std::string::npos));
-                        m_cookies.push_back(c);
-                    } else {
-                        set_header(m_accumulator.substr(0, coldelim),
-                                   cxx_utils::string::utils::trim
-                                   (m_accumulator.substr(coldelim+1,
-                                                         std::string::npos)));
-                    }
-                    m_accumulator.clear();
-                }
-
-                void update_body()
-                {
-                    m_body += m_accumulator;
-                    m_accumulator.clear();
-
-                    std::string content_length;
-                    get_header(std::string("Content-length"), content_length);
-                    std::istringstream buf(content_length);
-                    size_t len;
-                    buf >> len;
-                    if( m_body.size() == len) {
+                    switch (header_done()) {
+                    case body_none:
                         m_curstate = parsing_done;
+                        break;
+                    case body_fixed:
+                    case body_chunk_size:
+                        m_curstate = parsing_body;
+                        break;
+                    case body_invalid:
+                        reject();
+                        break;
+                    default:
+                        // a request body must be length- or chunk-delimited
+                        m_suggestedcode = http_response::bad_request;
+                        m_curstate = parsing_err;
+                        break;
                     }
                 }
+
             public:
                 http_request() : http_message(),
                                  m_suggestedcode(http_response::max_code),
@@ -169,8 +212,12 @@ namespace cxx_utils
                     http_message(maj, min),
                     m_suggestedcode(http_response::max_code),
                     m_curmethod(method), 
-                    m_curstate(parsing_done), m_uri(uri), m_nextbreaktok(' ')
+                    m_curstate(parsing_done), m_uri(), m_nextbreaktok(' ')
                 {
+                    m_uri.offset = m_raw.size();
+                    m_uri.length = uri.size();
+                    m_raw += uri;
+                    m_tokstart = m_raw.size();
                 }
 
                 virtual ~http_request()
@@ -187,129 +234,185 @@ namespace cxx_utils
                     m_suggestedcode = http_response::max_code;
                 }
 
-                virtual void updated()
+                /**
+                 * Readies the object for the next request on a persistent
+                 * connection. Buffers keep their capacity and any body sink
+                 * stays registered, so parsing request after request on one
+                 * object settles into reusing the same memory.
+                 */
+                void reset()
                 {
-                    if( m_accumulator.size() == 0 ||
-                        *(m_accumulator.end() - 1) != m_nextbreaktok) {
-                        return;
-                    }
+                    reset_message();
+                    m_suggestedcode = http_response::max_code;
+                    m_curmethod = max_method;
+                    m_curstate = parsing_method;
+                    m_uri = field_view();
+                    m_nextbreaktok = ' ';
+                }
+
+                methods method() const { return m_curmethod; }
+
+                /**
+                 * The query part of the URI (after '?', before any '#'),
+                 * ready to hand to query_params::parse().
+                 */
+                cxx_utils::string::string_ref query() const
+                {
+                    cxx_utils::string::string_ref target = uri();
+                    const char *q = static_cast<const char *>
+                        (std::memchr(target.data(), '?', target.size()));
+                    if (!q)
+                        return cxx_utils::string::string_ref();
+                    const char *hash = static_cast<const char *>
+                        (std::memchr(q, '#', target.end() - q));
+                    return cxx_utils::string::string_ref
+                        (q + 1, (hash ? hash : target.end()) - (q + 1));
+                }
 
-                    switch(m_curstate){
-                    case parsing_done:
+                /// The request target; refers into the message.
+                cxx_utils::string::string_ref uri() const
+                {
+                    return view(m_uri);
+                }
+
+                /**
+                 * Parsing stops at the end of the current message: when the
+                 * result is parse_complete, the bytes past @consumed belong to
+                 * the next (pipelined) request and can be fed, unmoved, after
+                 * a reset(). Feeding a completed request without a reset() is
+                 * still answered with request_entity_too_large.
+                 */
+                virtual feed_result feed(const char *buf, std::size_t len)
+                {
+                    const char *p = buf;
+                    const char *const end = buf + len;
+
+                    if (m_curstate == parsing_done && len) {
                         m_suggestedcode =
                             http_response::request_entity_too_large;
                         m_curstate = parsing_err;
-                    case parsing_err:
-                        break;
-                    default:
-                        m_suggestedcode = http_response::bad_request;
-                        m_curstate = parsing_err;
-                        break;
-                    case parsing_method:
-                        update_method();
-                        break;
-                    case parsing_uri:
-                        update_uri();
-                        break;
-                    case parsing_version:
-                        update_version();
-                        break;
-                    case parsing_headers:
-                        update_headers();
-                        break;
-                    case parsing_body:
-                        update_body();
-                        break;
                     }
-                }
 
-                virtual std::string serialize() const
-                {
-                    std::string result = "";
+                    while (p != end && m_curstate != parsing_done) {
+                        if (m_curstate == parsing_body) {
+                            switch (feed_body(p, end)) {
+                            case 1:
+                                m_curstate = parsing_done;
+                                break;
+                            case -1:
+                                reject();
+                                break;
+                            }
+                            continue;
+                        }
 
-                    switch(m_curmethod) {
-                    case get_method:
-                        result += "GET";
-                        break;
-                    case put_method:
-                        result += "PUT";
-                        break;
-                    case post_method:
-                        result += "POST";
-                        break;
-                    case delete_method:
-                        result += "DELETE";
-                        break;
-                    case head_method:
-                        result += "HEAD";
-                        break;
-                    case options_method:
-                        result += "OPTIONS";
-                        break;
-                    case trace_method:
-                        result += "TRACE";
-                        break;
-                    default:
-                        return "<ERROR>";
-                    }
+                        if (m_curstate == parsing_err) {
+                            p = end;
+                            break;
+                        }
 
-                    result += ' ';
-                    result += m_uri;
-                    result += " HTTP/";
-                    result += std::to_string(m_maj);
-                    result += ".";
-                    result += std::to_string(m_min);
-                    result += "\r\n";
+                        const int scanned =
+                            scan_token(p, end, m_nextbreaktok, token_cap());
+                        if (scanned == 0)
+                            break;
+                        if (scanned < 0) {
+                            fail(m_curstate == parsing_headers ?
+                                 err_headers_too_large :
+                                 err_start_line_too_long);
+                            reject();
+                            continue;
+                        }
 
-                    std::string hdrval;
+                        switch(m_curstate){
+                        default:
+                            m_suggestedcode = http_response::bad_request;
+                            m_curstate = parsing_err;
+                            break;
+                        case parsing_method:
+                            update_method();
+                            break;
+                        case parsing_uri:
+                            update_uri();
+                            break;
+                        case parsing_version:
+                            update_version();
+                            break;
+                        case parsing_headers:
+                            update_headers();
+                            break;
+                        }
+                    }
 
-                    result += "Date: ";
-                    if( !get_header("Date", hdrval) )
-                        result += cxx_utils::net::http::utils::webdate
-                            (time(NULL)) ;
-                    else
-                        result += hdrval;
-                    result += "\r\n";
+                    feed_result result;
+                    result.consumed = p - buf;
+                    result.status = m_curstate == parsing_done ?
+                        parse_complete : m_curstate == parsing_err ?
+                        parse_error : parse_incomplete;
+                    return result;
+                }
 
-                    result += "User-Agent: ";
-                    if( !get_header("User-Agent", hdrval) )
-                        result += "cxxutils 0.1";
+                virtual std::size_t serialize_head(char *buf,
+                                                   std::size_t len) const
+                {
+                    head_writer out(buf, len);
+
+                    const char *name = method_name(m_curmethod);
+                    if (!name)
+                        return 0;
+
+                    out.put(name);
+                    out.put(" ", 1);
+                    out.put(view(m_uri));
+                    out.put(" HTTP/", 6);
+                    out.put_uint(m_maj);
+                    out.put(".", 1);
+                    out.put_uint(m_min);
+                    out.put("\r\n", 2);
+
+                    cxx_utils::string::string_ref hdrval;
+                    if( get_header(hdr_date, hdrval) )
+                        out.put_header("Date", hdrval);
                     else
-                        result += hdrval;
-                    result += "\r\n";
-
-                    for(http_message::headers::const_iterator it =
-                            m_httphdrs.cbegin();
-                        it != m_httphdrs.cend(); ++it) {
-                        if(cxx_utils::string::utils::istringcmp(it->first,
-                                                                "Date") ||
-                           cxx_utils::string::utils::istringcmp(it->first,
-                                                                "User-Agent") ||
-                           cxx_utils::string::utils::istringcmp(it->first,
-                                                                "Content-Length")) {
+                        out.put_date(time(NULL));
+
+                    if( !get_header(hdr_user_agent, hdrval) )
+                        hdrval = "cxxutils 0.1";
+                    out.put_header("User-Agent", hdrval);
+
+                    for(int hdr = 0; hdr < max_header; ++hdr) {
+                        if(hdr == hdr_date || hdr == hdr_user_agent ||
+                           hdr == hdr_content_length ||
+                           hdr == hdr_transfer_encoding ||
+                           !present(m_known[hdr])) {
                             continue;
                         }
-                        result += it->first;
-                        result += ": ";
-                        result += it->second;
-                        result += "\r\n";
+                        out.put_header(header_name(known_headers(hdr)),
+                                       view(m_known[hdr]));
                     }
 
-                    for(cookiejar::const_iterator ick = m_cookies.cbegin();
-                        ick != m_cookies.cend(); ++ick) {
-                        result += "Cookie: ";
-                        result += ick->value();
-                        result += "\r\n";
+                    for(extension_headers::const_iterator it =
+                            m_extra.begin(); it != m_extra.end(); ++it) {
+                        out.put_header(view(it->name), view(it->value));
                     }
 
-                    if (!m_body.empty()) {
-                        result += "Content-Length: " +
-                            std::to_string(m_body.length());
-                        result += "\r\n";
-                        result += m_body;
+                    out.put_cookies(*this);
+
+                    if (!wire_body().empty()) {
+                        out.put("Content-Length: ", 16);
+                        out.put_uint(wire_body().size());
+                        out.put("\r\n", 2);
                     }
-                    result += "\r\n";
-                    return result;
+                    out.put("\r\n", 2);
+                    return out.size();
+                }
+
+                using http_message::serialize;
+
+                virtual std::string serialize() const
+                {
+                    if (!method_name(m_curmethod))
+                        return "<ERROR>";
+                    return http_message::serialize();
                 }
             };
         }
@@ -15,7 +15,6 @@ namespace cxx_utils
                 enum parsing_states {
                     parsing_version,
                     parsing_status,
-                    parsing_reason,
                     parsing_headers,
                     parsing_body,
                     parsing_done,
@@ -66,6 +65,7 @@ namespace cxx_utils
                     unsupported_media_type=415,
                     request_range_not_satisfiable=416,
                     expectation_failed=417,
+                    request_header_fields_too_large=431,
 
                     /* 5xx: server error */
                     internal_error=500,
@@ -82,10 +82,398 @@ namespace cxx_utils
 
                 codes          m_curcode;
                 parsing_states m_curstate;
-                std::string    m_uri;
+                field_view     m_reason;
                 char           m_nextbreaktok;
+                bool           m_headresponse;
+
+                template <std::size_t N>
+                static cxx_utils::string::string_ref
+                literal(const char (&text)[N])
+                {
+                    return cxx_utils::string::string_ref(text, N - 1);
+                }
+
+                /// Whether a response with this status may carry a body.
+                bool bodiless() const
+                {
+                    return m_headresponse || m_curcode < okay ||
+                        m_curcode == no_content || m_curcode == not_modified;
+                }
+
+                void update_version()
+                {
+                    if ( parse_version(take_token(" \t")) < 0 ) {
+                        m_curstate = parsing_err;
+                    } else {
+                        m_curstate = parsing_status;
+                        m_nextbreaktok = '\n';
+                    }
+                }
+
+                void update_status()
+                {
+                    cxx_utils::string::string_ref line =
+                        view(take_token(" \r\n\t"));
+                    if (line.size() < 3 || !isdigit(line[0]) ||
+                        !isdigit(line[1]) || !isdigit(line[2]) ||
+                        line[0] == '0' ||
+                        (line.size() > 3 && line[3] != ' ' &&
+                         line[3] != '\t')) {
+                        m_curstate = parsing_err;
+                        return;
+                    }
+
+                    m_curcode = codes((line[0] - '0') * 100 +
+                                      (line[1] - '0') * 10 + (line[2] - '0'));
+                    cxx_utils::string::string_ref reason =
+                        cxx_utils::string::utils::trim_ref
+                        (cxx_utils::string::string_ref(line.data() + 3,
+                                                       line.size() - 3));
+                    m_reason.offset = reason.data() - m_raw.data();
+                    m_reason.length = reason.size();
+                    m_curstate = parsing_headers;
+                    begin_headers();
+                }
+
+                void update_headers()
+                {
+                    switch (header_line()) {
+                    case 0:
+                        return;
+                    case -1:
+                        m_curstate = parsing_err;
+                        return;
+                    }
+
+                    body_states framing = header_done();
+                    if (bodiless()) {
+                        m_bodystate = body_none;
+                        m_curstate = parsing_done;
+                        return;
+                    }
+
+                    switch (framing) {
+                    case body_none:
+                        // no framing: the body runs until the peer closes
+                        m_bodystate = body_until_close;
+                        m_curstate = parsing_body;
+                        break;
+                    case body_invalid:
+                        m_curstate = parsing_err;
+                        break;
+                    default:
+                        m_curstate = parsing_body;
+                        break;
+                    }
+                }
 
             public:
+                http_response() : http_message(), m_curcode(max_code),
+                                  m_curstate(parsing_version), m_reason(),
+                                  m_nextbreaktok(' '), m_headresponse(false)
+                {
+                }
+
+                explicit http_response(codes code, std::uint32_t maj = 1,
+                                       std::uint32_t min = 1) :
+                    http_message(maj, min), m_curcode(code),
+                    m_curstate(parsing_done), m_reason(),
+                    m_nextbreaktok(' '), m_headresponse(false)
+                {
+                }
+
+                virtual ~http_response()
+                {
+                }
+
+                /// Readies the object to parse the next response.
+                void reset()
+                {
+                    reset_message();
+                    m_curcode = max_code;
+                    m_curstate = parsing_version;
+                    m_reason = field_view();
+                    m_nextbreaktok = ' ';
+                }
+
+                codes code() const { return m_curcode; }
+
+                /// The reason phrase as received; empty for built responses.
+                cxx_utils::string::string_ref reason() const
+                {
+                    return view(m_reason);
+                }
+
+                /**
+                 * Marks this as the response to a HEAD request, which never
+                 * carries a body whatever its headers say. When serialized,
+                 * Content-Length is only sent if set with set_header(), as
+                 * the size of the resource rather than of the empty body.
+                 */
+                void set_head_response(bool head)
+                {
+                    m_headresponse = head;
+                }
+
+                /**
+                 * The pre-rendered "HTTP/1.1 <code> <reason>\r\n" line for
+                 * @code, or an empty ref for codes outside the table.
+                 */
+                static cxx_utils::string::string_ref status_line(codes code)
+                {
+                    switch (code) {
+                    case cont:
+                        return literal("HTTP/1.1 100 Continue\r\n");
+                    case switching_protocols:
+                        return literal("HTTP/1.1 101 Switching Protocols\r\n");
+                    case okay:
+                        return literal("HTTP/1.1 200 OK\r\n");
+                    case created:
+                        return literal("HTTP/1.1 201 Created\r\n");
+                    case accepted:
+                        return literal("HTTP/1.1 202 Accepted\r\n");
+                    case non_authoritative:
+                        return literal("HTTP/1.1 203 Non-Authoritative Information\r\n");
+                    case no_content:
+                        return literal("HTTP/1.1 204 No Content\r\n");
+                    case reset_content:
+                        return literal("HTTP/1.1 205 Reset Content\r\n");
+                    case partial_content:
+                        return literal("HTTP/1.1 206 Partial Content\r\n");
+                    case multiple_choices:
+                        return literal("HTTP/1.1 300 Multiple Choices\r\n");
+                    case moved_permanently:
+                        return literal("HTTP/1.1 301 Moved Permanently\r\n");
+                    case found:
+                        return literal("HTTP/1.1 302 Found\r\n");
+                    case see_other:
+                        return literal("HTTP/1.1 303 See Other\r\n");
+                    case not_modified:
+                        return literal("HTTP/1.1 304 Not Modified\r\n");
+                    case use_proxy:
+                        return literal("HTTP/1.1 305 Use Proxy\r\n");
+                    case temporary_redirect:
+                        return literal("HTTP/1.1 307 Temporary Redirect\r\n");
+                    case bad_request:
+                        return literal("HTTP/1.1 400 Bad Request\r\n");
+                    case unauthorized:
+                        return literal("HTTP/1.1 401 Unauthorized\r\n");
+                    case payment_required:
+                        return literal("HTTP/1.1 402 Payment Required\r\n");
+                    case forbidden:
+                        return literal("HTTP/1.1 403 Forbidden\r\n");
+                    case not_found:
+                        return literal("HTTP/1.1 404 Not Found\r\n");
+                    case method_not_allowed:
+                        return literal("HTTP/1.1 405 Method Not Allowed\r\n");
+                    case not_acceptable:
+                        return literal("HTTP/1.1 406 Not Acceptable\r\n");
+                    case proxy_auth_required:
+                        return literal("HTTP/1.1 407 Proxy Authentication Required\r\n");
+                    case request_time_out:
+                        return literal("HTTP/1.1 408 Request Timeout\r\n");
+                    case conflict:
+                        return literal("HTTP/1.1 409 Conflict\r\n");
+                    case gone:
+                        return literal("HTTP/1.1 410 Gone\r\n");
+                    case length_required:
+                        return literal("HTTP/1.1 411 Length Required\r\n");
+                    case precondition_failed:
+                        return literal("HTTP/1.1 412 Precondition Failed\r\n");
+                    case request_entity_too_large:
+                        return literal("HTTP/1.1 413 Request Entity Too Large\r\n");
+                    case request_uri_too_large:
+                        return literal("HTTP/1.1 414 Request-URI Too Large\r\n");
+                    case request_header_fields_too_large:
+                        return literal("HTTP/1.1 431 Request Header Fields Too Large\r\n");
+                    case unsupported_media_type:
+                        return literal("HTTP/1.1 415 Unsupported Media Type\r\n");
+                    case request_range_not_satisfiable:
+                        return literal("HTTP/1.1 416 Requested Range Not Satisfiable\r\n");
+                    case expectation_failed:
+                        return literal("HTTP/1.1 417 Expectation Failed\r\n");
+                    case internal_error:
+                        return literal("HTTP/1.1 500 Internal Server Error\r\n");
+                    case not_implemented:
+                        return literal("HTTP/1.1 501 Not Implemented\r\n");
+                    case bad_gateway:
+                        return literal("HTTP/1.1 502 Bad Gateway\r\n");
+                    case service_unavailable:
+                        return literal("HTTP/1.1 503 Service Unavailable\r\n");
+                    case gateway_timeout:
+                        return literal("HTTP/1.1 504 Gateway Timeout\r\n");
+                    case http_version_not_supported:
+                        return literal("HTTP/1.1 505 HTTP Version Not Supported\r\n");
+                    default:
+                        return cxx_utils::string::string_ref();
+                    }
+                }
+
+                /**
+                 * As with http_request::feed(), parsing stops at the end of
+                 * the current response and anything past @consumed belongs
+                 * to the next one.
+                 */
+                virtual feed_result feed(const char *buf, std::size_t len)
+                {
+                    const char *p = buf;
+                    const char *const end = buf + len;
+
+                    if (m_curstate == parsing_done && len)
+                        m_curstate = parsing_err;
+
+                    while (p != end && m_curstate != parsing_done) {
+                        if (m_curstate == parsing_body) {
+                            switch (feed_body(p, end)) {
+                            case 1:
+                                m_curstate = parsing_done;
+                                break;
+                            case -1:
+                                m_curstate = parsing_err;
+                                break;
+                            }
+                            continue;
+                        }
+
+                        if (m_curstate == parsing_err) {
+                            p = end;
+                            break;
+                        }
+
+                        const int scanned = scan_token
+                            (p, end, m_nextbreaktok,
+                             m_curstate == parsing_headers ? header_cap() :
+                             m_limits.max_start_line);
+                        if (scanned == 0)
+                            break;
+                        if (scanned < 0) {
+                            fail(m_curstate == parsing_headers ?
+                                 err_headers_too_large :
+                                 err_start_line_too_long);
+                            m_curstate = parsing_err;
+                            continue;
+                        }
+
+                        switch(m_curstate){
+                        default:
+                            m_curstate = parsing_err;
+                            break;
+                        case parsing_version:
+                            update_version();
+                            break;
+                        case parsing_status:
+                            update_status();
+                            break;
+                        case parsing_headers:
+                            update_headers();
+                            break;
+                        }
+                    }
+
+                    return result(p - buf);
+                }
+
+                /**
+                 * Tells the parser the peer closed the connection; this
+                 * completes a body that is delimited by connection close and
+                 * is an error anywhere else mid-message.
+                 */
+                feed_result finish()
+                {
+                    if (m_curstate == parsing_body &&
+                        m_bodystate == body_until_close) {
+                        m_bodystate = body_none;
+                        m_curstate = parsing_done;
+                    } else if (m_curstate != parsing_done) {
+                        m_curstate = parsing_err;
+                    }
+                    return result(0);
+                }
+
+                /**
+                 * Renders the status line and headers into @buf, returning
+                 * the number of bytes the head needs; nothing useful is in
+                 * @buf unless that is <= @len.
+                 */
+                virtual std::size_t serialize_head(char *buf,
+                                                   std::size_t len) const
+                {
+                    head_writer out(buf, len);
+
+                    cxx_utils::string::string_ref line = status_line(m_curcode);
+                    if (!line.empty() && m_maj == 1 && m_min == 1) {
+                        out.put(line);
+                    } else {
+                        out.put("HTTP/", 5);
+                        out.put_uint(m_maj);
+                        out.put(".", 1);
+                        out.put_uint(m_min);
+                        out.put(" ", 1);
+                        out.put_uint(m_curcode);
+                        out.put(" ", 1);
+                        if (!line.empty())
+                            out.put(line.data() + 13,
+                                    line.size() - 13 - 2);
+                        else
+                            out.put(reason());
+                        out.put("\r\n", 2);
+                    }
+
+                    cxx_utils::string::string_ref hdrval;
+                    if (get_header(hdr_date, hdrval)) {
+                        out.put_header("Date", hdrval);
+                    } else {
+                        out.put_date(time(NULL));
+                    }
+
+                    if (!get_header(hdr_server, hdrval))
+                        hdrval = "cxxutils 0.1";
+                    out.put_header("Server", hdrval);
+
+                    for (int hdr = 0; hdr < max_header; ++hdr) {
+                        if (hdr == hdr_date || hdr == hdr_server ||
+                            hdr == hdr_content_length ||
+                            hdr == hdr_transfer_encoding ||
+                            !present(m_known[hdr])) {
+                            continue;
+                        }
+                        out.put_header(header_name(known_headers(hdr)),
+                                       view(m_known[hdr]));
+                    }
+
+                    for (extension_headers::const_iterator it =
+                             m_extra.begin(); it != m_extra.end(); ++it) {
+                        out.put_header(view(it->name), view(it->value));
+                    }
+
+                    for (std::size_t i = 0; i < m_setcookies.size(); ++i)
+                        out.put_header("Set-Cookie", view(m_setcookies[i]));
+
+                    if (m_curcode >= okay && m_curcode != no_content &&
+                        m_curcode != not_modified) {
+                        if (!m_headresponse) {
+                            out.put("Content-Length: ", 16);
+                            out.put_uint(wire_body().size());
+                            out.put("\r\n", 2);
+                        } else if (get_header(hdr_content_length, hdrval)) {
+                            // the length of the body a GET would have had
+                            out.put_header("Content-Length", hdrval);
+                        }
+                    }
+                    out.put("\r\n", 2);
+                    return out.size();
+                }
+
+            private:
+                feed_result result(std::size_t consumed) const
+                {
+                    feed_result res;
+                    res.consumed = consumed;
+                    res.status = m_curstate == parsing_done ?
+                        parse_complete : m_curstate == parsing_err ?
+                        parse_error : parse_incomplete;
+                    return res;
+                }
             };
         }
     }
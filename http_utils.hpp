@@ -15,7 +15,21 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <atomic>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <utility>
+
+#include "strings.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #ifndef __HTTP_UTILS__H__
 #define __HTTP_UTILS__H__
@@ -26,6 +40,161 @@ namespace cxx_utils
     {
         namespace http
         {
+        /**
+         * @brief Renders RFC 7231 IMF-fixdate strings
+         * ("Sun, 06 Nov 1994 08:49:37 GMT"), formatting at most once per
+         * second.
+         *
+         * The current rendering lives in one of two slots; a refresh writes
+         * the idle slot and then atomically flips m_current to it. Readers
+         * never block: each slot is guarded by a sequence count, and the
+         * text is held in atomic words so a reader racing a refresh simply
+         * retries. A thread that loses the race to refresh formats into its
+         * own buffer instead of waiting.
+         */
+        class date_cache
+        {
+        public:
+            /// Length of an IMF-fixdate, excluding any terminator.
+            static const std::size_t length = 29;
+
+        private:
+            struct slot
+            {
+                std::atomic<std::uint32_t> seq;
+                std::atomic<std::int64_t>  when;
+                std::atomic<std::uint64_t> text[4];
+            };
+
+            slot                      m_slots[2];
+            std::atomic<unsigned int> m_current;
+            std::atomic_flag          m_refreshing;
+
+            static void put2(char *out, int value)
+            {
+                out[0] = char('0' + value / 10);
+                out[1] = char('0' + value % 10);
+            }
+
+            bool load(const slot &s, std::int64_t now, char *out) const
+            {
+                std::uint64_t words[4];
+                for (;;) {
+                    const std::uint32_t seq =
+                        s.seq.load(std::memory_order_acquire);
+                    if (seq & 1)
+                        return false;
+                    const std::int64_t when =
+                        s.when.load(std::memory_order_relaxed);
+                    for (int i = 0; i < 4; ++i)
+                        words[i] = s.text[i].load(std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (s.seq.load(std::memory_order_relaxed) != seq)
+                        continue;
+                    if (when != now)
+                        return false;
+                    std::memcpy(out, words, length);
+                    return true;
+                }
+            }
+
+            void store(slot &s, std::int64_t now, const char *text)
+            {
+                std::uint64_t words[4] = { 0, 0, 0, 0 };
+                std::memcpy(words, text, length);
+
+                const std::uint32_t seq =
+                    s.seq.load(std::memory_order_relaxed);
+                s.seq.store(seq + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                s.when.store(now, std::memory_order_relaxed);
+                for (int i = 0; i < 4; ++i)
+                    s.text[i].store(words[i], std::memory_order_relaxed);
+                s.seq.store(seq + 2, std::memory_order_release);
+            }
+
+        public:
+            date_cache() : m_current(0)
+            {
+                m_refreshing.clear();
+                for (int i = 0; i < 2; ++i) {
+                    m_slots[i].seq.store(0);
+                    m_slots[i].when.store(-1);
+                    for (int w = 0; w < 4; ++w)
+                        m_slots[i].text[w].store(0);
+                }
+            }
+
+            /// A process-wide cache shared by all message serializers.
+            static date_cache &instance()
+            {
+                static date_cache cache;
+                return cache;
+            }
+
+            /**
+             * Formats @now into exactly @length bytes at @out, without
+             * consulting or updating any cache.
+             */
+            static void render(time_t now, char *out)
+            {
+                static const char days[] = "SunMonTueWedThuFriSat";
+                static const char months[] =
+                    "JanFebMarAprMayJunJulAugSepOctNovDec";
+                struct tm curTm;
+#ifndef WIN32
+                gmtime_r(&now, &curTm);
+#else
+                _gmtime64_s(&curTm, &now);
+#endif
+                std::memcpy(out, days + 3 * curTm.tm_wday, 3);
+                out[3] = ',';
+                out[4] = ' ';
+                put2(out + 5, curTm.tm_mday);
+                out[7] = ' ';
+                std::memcpy(out + 8, months + 3 * curTm.tm_mon, 3);
+                out[11] = ' ';
+                const int year = curTm.tm_year + 1900;
+                put2(out + 12, (year / 100) % 100);
+                put2(out + 14, year % 100);
+                out[16] = ' ';
+                put2(out + 17, curTm.tm_hour);
+                out[19] = ':';
+                put2(out + 20, curTm.tm_min);
+                out[22] = ':';
+                put2(out + 23, curTm.tm_sec);
+                std::memcpy(out + 25, " GMT", 4);
+            }
+
+            /**
+             * Writes the IMF-fixdate for @now into @out (@length bytes, not
+             * terminated), re-rendering only when the second has changed.
+             */
+            void format(time_t now, char *out)
+            {
+                const unsigned int cur =
+                    m_current.load(std::memory_order_acquire);
+                if (load(m_slots[cur], now, out))
+                    return;
+
+                render(now, out);
+                if (m_refreshing.test_and_set(std::memory_order_acquire))
+                    return;
+                const unsigned int next =
+                    m_current.load(std::memory_order_relaxed) ^ 1;
+                store(m_slots[next], now, out);
+                m_current.store(next, std::memory_order_release);
+                m_refreshing.clear(std::memory_order_release);
+            }
+
+            std::string format(time_t now)
+            {
+                char buf[length];
+                format(now, buf);
+                return std::string(buf, length);
+            }
+        };
+
         class utils
         {
         public:
@@ -43,72 +212,481 @@ namespace cxx_utils
                 return std::string(buf);
             }
 
-            static std::string urldecode( const std::string &urltext )
+            /// The current time as an RFC 7231 IMF-fixdate, cached per second.
+            static std::string httpdate( time_t now )
             {
-                std::string result;
+                return date_cache::instance().format(now);
+            }
+
+            enum url_class_bits {
+                url_encode  = 1,  ///< byte must be %-escaped by urlencode
+                url_special = 2   ///< byte is '%' or '+' to urldecode
+            };
+
+            /// Per-byte url_class_bits.
+            static const unsigned char *url_classes()
+            {
+                static const unsigned char table[256] = {
+                    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                    1, 0, 1, 1, 1, 3, 1, 1, 0, 0, 0, 3, 1, 0, 0, 1,
+                    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1,
+                    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0,
+                    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1,
+                    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+                };
+                return table;
+            }
+
+            /// Per-byte hex digit value, 0xff for non-hex bytes.
+            static const unsigned char *hex_values()
+            {
+                static const unsigned char table[256] = {
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+                };
+                return table;
+            }
+
+        private:
+#if defined(__AVX2__)
+            typedef __m256i url_block;
+            static const std::size_t url_block_size = 32;
 
-                for(size_t i = 0; i < urltext.length(); ++i)
-                {
-                    char c = urltext[i];
-                    if (urltext[i] == '%')
-                    {
-                        if((i+2 < urltext.length()) &&
-                           isxdigit(urltext[i+1]) && isxdigit(urltext[i+2]))
-                        {
-                            char *end;
-                            std::string hexstr = urltext.substr(i+1, 2);
-                            c = strtol(hexstr.c_str(), &end, 16);
-                            if( end == NULL || *end != '\0')
-                                return result;
-                            i+=2;
-                            if (c == '+')
-                                c = ' ';
+            static url_block url_load(const char *p)
+            {
+                return _mm256_loadu_si256((const __m256i *)p);
+            }
+            static void url_store(char *p, url_block v)
+            {
+                _mm256_storeu_si256((__m256i *)p, v);
+            }
+            static url_block url_splat(char c) { return _mm256_set1_epi8(c); }
+            static url_block url_eq(url_block a, url_block b)
+            {
+                return _mm256_cmpeq_epi8(a, b);
+            }
+            static url_block url_or(url_block a, url_block b)
+            {
+                return _mm256_or_si256(a, b);
+            }
+            static url_block url_add(url_block a, url_block b)
+            {
+                return _mm256_add_epi8(a, b);
+            }
+            static url_block url_lt(url_block a, url_block b)
+            {
+                return _mm256_cmpgt_epi8(b, a);
+            }
+            static std::uint32_t url_mask(url_block v)
+            {
+                return std::uint32_t(_mm256_movemask_epi8(v));
+            }
+#elif defined(__SSE2__)
+            typedef __m128i url_block;
+            static const std::size_t url_block_size = 16;
+
+            static url_block url_load(const char *p)
+            {
+                return _mm_loadu_si128((const __m128i *)p);
+            }
+            static void url_store(char *p, url_block v)
+            {
+                _mm_storeu_si128((__m128i *)p, v);
+            }
+            static url_block url_splat(char c) { return _mm_set1_epi8(c); }
+            static url_block url_eq(url_block a, url_block b)
+            {
+                return _mm_cmpeq_epi8(a, b);
+            }
+            static url_block url_or(url_block a, url_block b)
+            {
+                return _mm_or_si128(a, b);
+            }
+            static url_block url_add(url_block a, url_block b)
+            {
+                return _mm_add_epi8(a, b);
+            }
+            static url_block url_lt(url_block a, url_block b)
+            {
+                return _mm_cmplt_epi8(a, b);
+            }
+            static std::uint32_t url_mask(url_block v)
+            {
+                return std::uint32_t(_mm_movemask_epi8(v));
+            }
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+            /// Lanes of @v holding a byte in [lo, hi] (signed-compare trick).
+            static url_block url_in_range(url_block v, unsigned char lo,
+                                          unsigned char hi)
+            {
+                url_block shifted = url_add(v, url_splat(char(0x80 - lo)));
+                return url_lt(shifted, url_splat(char(0x80 + (hi - lo + 1))));
+            }
+
+            /// Bitmask of lanes urlencode may copy through unchanged.
+            static std::uint32_t url_safe_mask(url_block v)
+            {
+                url_block safe = url_or(url_in_range(v, 'a', 'z'),
+                                        url_in_range(v, 'A', 'Z'));
+                safe = url_or(safe, url_in_range(v, '0', '9'));
+                safe = url_or(safe, url_in_range(v, '(', '*'));
+                safe = url_or(safe, url_in_range(v, '-', '.'));
+                safe = url_or(safe, url_eq(v, url_splat('!')));
+                safe = url_or(safe, url_eq(v, url_splat('_')));
+                return url_mask(safe);
+            }
+#endif
+
+            static unsigned int url_ctz(std::uint32_t mask)
+            {
+                return __builtin_ctz(mask);
+            }
+
+        public:
+            /**
+             * Decodes @len bytes of @in into @out and returns the decoded
+             * length, which never exceeds @len; @out may equal @in for an
+             * in-place decode. Runs of bytes without '%' or '+' are skipped
+             * a vector block at a time. As with the std::string overload,
+             * decoding stops at the first malformed escape.
+             */
+            static std::size_t urldecode( const char *in, std::size_t len,
+                                          char *out )
+            {
+                const unsigned char *classes = url_classes();
+                const unsigned char *hex = hex_values();
+                const char *const start = out;
+                std::size_t i = 0;
+
+                while (i < len) {
+#if defined(__AVX2__) || defined(__SSE2__)
+                    if (len - i >= url_block_size) {
+                        url_block v = url_load(in + i);
+                        std::uint32_t special =
+                            url_mask(url_or(url_eq(v, url_splat('%')),
+                                            url_eq(v, url_splat('+'))));
+                        if (!special) {
+                            if (out != in + i)
+                                url_store(out, v);
+                            out += url_block_size;
+                            i += url_block_size;
+                            continue;
                         }
-                        else
-                            return result;
+                        const unsigned int run = url_ctz(special);
+                        if (out != in + i)
+                            std::memmove(out, in + i, run);
+                        out += run;
+                        i += run;
+                    }
+#endif
+                    const unsigned char c = in[i];
+                    if (!(classes[c] & url_special)) {
+                        *out++ = char(c);
+                        ++i;
+                        continue;
                     }
-                    else if (urltext[i] == '+')
-                    {
-                        c = ' ';
+                    if (c == '+') {
+                        *out++ = ' ';
+                        ++i;
+                        continue;
                     }
-                    result += c;
+                    if (i + 2 >= len ||
+                        hex[(unsigned char)in[i+1]] == 0xff ||
+                        hex[(unsigned char)in[i+2]] == 0xff)
+                        break;
+                    char decoded = char((hex[(unsigned char)in[i+1]] << 4) |
+                                        hex[(unsigned char)in[i+2]]);
+                    *out++ = decoded == '+' ? ' ' : decoded;
+                    i += 3;
                 }
+                return out - start;
+            }
+
+            static std::string urldecode( const std::string &urltext )
+            {
+                std::string result(urltext.size(), '\0');
+                if (!urltext.empty())
+                    result.resize(urldecode(urltext.data(), urltext.size(),
+                                            &result[0]));
                 return result;
             }
 
-            static std::string urlencode(const std::string uri)
+            /// Decodes @text in place; returns the new length.
+            static std::size_t urldecode_inplace( std::string &text )
             {
-                const std::string UNSAFECHARS = " /$&+,:;=?@'\"<>#%{}|\\^~[]`";
-                const char LOOKUP[] = "0123456789ABCDEF";
-                std::string result;
+                if (!text.empty())
+                    text.resize(urldecode(text.data(), text.size(),
+                                          &text[0]));
+                return text.size();
+            }
 
-                for (size_t i = 0; i < uri.length(); ++i)
-                {
-                    char c = uri[i];
+            /// Decodes @len bytes of @in onto the end of @out.
+            static void urldecode_append( std::string &out, const char *in,
+                                          std::size_t len )
+            {
+                const std::size_t old = out.size();
+                out.resize(old + len);
+                if (len)
+                    out.resize(old + urldecode(in, len, &out[old]));
+            }
+
+            /**
+             * Encodes @len bytes of @in onto the end of @out. The output is
+             * sized for the worst case once up front and trimmed at the end,
+             * and runs of safe bytes are copied a vector block at a time.
+             */
+            static void urlencode_append( std::string &out, const char *in,
+                                          std::size_t len )
+            {
+                static const char LOOKUP[] = "0123456789ABCDEF";
+                const unsigned char *classes = url_classes();
+                const std::size_t old = out.size();
+                out.resize(old + 3 * len);
+                if (!len)
+                    return;
+                char *o = &out[old];
+                const char *const start = o;
+                std::size_t i = 0;
+
+                while (i < len) {
+#if defined(__AVX2__) || defined(__SSE2__)
+                    if (len - i >= url_block_size) {
+                        url_block v = url_load(in + i);
+                        std::uint32_t unsafe = ~url_safe_mask(v);
+                        unsafe &= std::uint32_t((1ull << url_block_size) - 1);
+                        if (!unsafe) {
+                            url_store(o, v);
+                            o += url_block_size;
+                            i += url_block_size;
+                            continue;
+                        }
+                        const unsigned int run = url_ctz(unsafe);
+                        std::memcpy(o, in + i, run);
+                        o += run;
+                        i += run;
+                    }
+#endif
+                    unsigned char c = in[i++];
                     if (c == ' ')
-                    {
                         c = '+';
+                    if (classes[c] & url_encode) {
+                        o[0] = '%';
+                        o[1] = LOOKUP[c >> 4];
+                        o[2] = LOOKUP[c & 0xf];
+                        o += 3;
+                    } else {
+                        *o++ = char(c);
                     }
+                }
+                out.resize(old + (o - start));
+            }
 
-                    if (c <= 31 || c >= 127 ||
-                        UNSAFECHARS.find(c) != std::string::npos)
-                    {
-                        result += '%';
-                        result += LOOKUP[c >> 4];
-                        result += LOOKUP[c & 0xf];
-                    }
-                    else if (c == '+')
-                    {
-                        result += '%';
-                        result += '2';
-                        result += 'B';
+            static std::string urlencode(const std::string uri)
+            {
+                std::string result;
+                urlencode_append(result, uri.data(), uri.size());
+                return result;
+            }
+        };
+
+        /**
+         * @brief Splits a query string or an application/x-www-form-urlencoded
+         * body into decoded key/value pairs.
+         *
+         * Every key and value is decoded in a single pass into one arena
+         * buffer, and the pairs are string_refs into it, so no per-parameter
+         * strings are created. Both the arena and the pair array keep their
+         * capacity across parse() calls; reusing one query_params per
+         * connection makes steady-state parsing allocation-free.
+         */
+        class query_params
+        {
+        public:
+            struct param
+            {
+                cxx_utils::string::string_ref key;
+                cxx_utils::string::string_ref value;
+            };
+
+            typedef std::vector<param>::const_iterator const_iterator;
+
+        private:
+            std::string        m_arena;
+            std::vector<param> m_params;
+
+            cxx_utils::string::string_ref decode(const char *in,
+                                                std::size_t len, char *&out)
+            {
+                const char *start = out;
+                out += utils::urldecode(in, len, out);
+                return cxx_utils::string::string_ref(start, out - start);
+            }
+
+            /// Points the pairs, decoded into @base, at m_arena instead.
+            void rebase(const char *base)
+            {
+                const char *arena = m_arena.data();
+                for (std::vector<param>::iterator it = m_params.begin();
+                     it != m_params.end(); ++it) {
+                    it->key = cxx_utils::string::string_ref
+                        (arena + (it->key.data() - base), it->key.size());
+                    it->value = cxx_utils::string::string_ref
+                        (arena + (it->value.data() - base), it->value.size());
+                }
+            }
+
+        public:
+            query_params() : m_arena(), m_params() {}
+
+            query_params(const query_params &other) :
+                m_arena(other.m_arena), m_params(other.m_params)
+            {
+                rebase(other.m_arena.data());
+            }
+
+            /* a short arena lives inside the string itself, so even a
+             * moved one can change address */
+            query_params(query_params &&other) :
+                m_arena(), m_params(std::move(other.m_params))
+            {
+                const char *base = other.m_arena.data();
+                m_arena.swap(other.m_arena);
+                rebase(base);
+                other.m_params.clear();
+            }
+
+            query_params &operator=(const query_params &other)
+            {
+                if (this != &other) {
+                    m_arena = other.m_arena;
+                    m_params = other.m_params;
+                    rebase(other.m_arena.data());
+                }
+                return *this;
+            }
+
+            query_params &operator=(query_params &&other)
+            {
+                if (this != &other) {
+                    const char *base = other.m_arena.data();
+                    m_arena.swap(other.m_arena);
+                    m_params.swap(other.m_params);
+                    rebase(base);
+                    other.m_params.clear();
+                }
+                return *this;
+            }
+
+            explicit query_params(const cxx_utils::string::string_ref &text) :
+                m_arena(), m_params()
+            {
+                parse(text);
+            }
+
+            /**
+             * Replaces the current contents with the pairs in @text. A
+             * leading '?' is skipped and a '#' fragment ignored; empty
+             * pieces ("a=1&&b=2") are dropped and a piece without '='
+             * yields an empty value. Returns the number of pairs.
+             */
+            std::size_t parse(const cxx_utils::string::string_ref &text)
+            {
+                const char *p = text.begin();
+                const char *end = text.end();
+                if (p != end && *p == '?')
+                    ++p;
+                const char *hash = static_cast<const char *>
+                    (std::memchr(p, '#', end - p));
+                if (hash)
+                    end = hash;
+
+                m_params.clear();
+                m_arena.resize(end - p);
+                if (p == end)
+                    return 0;
+
+                std::size_t pieces = 1;
+                for (const char *amp = p;
+                     (amp = static_cast<const char *>
+                      (std::memchr(amp, '&', end - amp))) != 0; ++amp)
+                    ++pieces;
+                m_params.reserve(pieces);
+
+                char *out = &m_arena[0];
+                while (p < end) {
+                    const char *amp = static_cast<const char *>
+                        (std::memchr(p, '&', end - p));
+                    const char *stop = amp ? amp : end;
+                    if (stop != p) {
+                        const char *eq = static_cast<const char *>
+                            (std::memchr(p, '=', stop - p));
+                        param pr;
+                        pr.key = decode(p, (eq ? eq : stop) - p, out);
+                        pr.value = eq ? decode(eq + 1, stop - (eq + 1), out) :
+                            cxx_utils::string::string_ref(out, 0);
+                        m_params.push_back(pr);
                     }
-                    else 
-                    {
-                        result += c;
+                    p = stop + 1;
+                }
+                return m_params.size();
+            }
+
+            std::size_t size() const { return m_params.size(); }
+            bool empty() const { return m_params.empty(); }
+            const param &operator[](std::size_t i) const
+            {
+                return m_params[i];
+            }
+            const_iterator begin() const { return m_params.begin(); }
+            const_iterator end() const { return m_params.end(); }
+
+            /**
+             * Finds the first pair whose decoded key is @key; @value then
+             * refers into this object until the next parse().
+             */
+            bool find(const cxx_utils::string::string_ref &key,
+                      cxx_utils::string::string_ref &value) const
+            {
+                for (const_iterator it = m_params.begin();
+                     it != m_params.end(); ++it) {
+                    if (it->key == key) {
+                        value = it->value;
+                        return true;
                     }
                 }
-                return result;
+                return false;
+            }
+
+            bool has(const cxx_utils::string::string_ref &key) const
+            {
+                cxx_utils::string::string_ref ignored;
+                return find(key, ignored);
             }
         };
         }
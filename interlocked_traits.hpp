@@ -1,3 +1,5 @@
+#pragma once
+
 namespace cxx_utils
 {
     struct null_interlocked_trait
@@ -8,5 +10,5 @@ namespace cxx_utils
             locked_exchange(locked_exchange_type &e){}
             ~locked_exchange(){}
         };
-    }
+    };
 }
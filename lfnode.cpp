@@ -1,65 +1,268 @@
 #include "lockfree_stack.hpp"
 
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <vector>
 #include <unistd.h>
 
 using cxx_utils::concurrent::lfstack;
 
-lfstack<int> stack;
-std::atomic_int_fast64_t pop1;
-std::atomic_int_fast64_t pop2;
-std::atomic_int_fast64_t times;
+struct counters
+{
+    std::atomic_int_fast64_t pop1;
+    std::atomic_int_fast64_t pop2;
+    std::atomic_int_fast64_t times;
+};
 
-void pusher(int n)
+template <class stack_type>
+void pusher(stack_type &stack, int n)
 {
     for( unsigned int i = 0; i < 1000000; ++i )
         stack.push(n);
 }
 
-void popper()
+template <class stack_type>
+void popper(stack_type &stack, counters &c)
 {
-    while( !stack.empty() )
+    int i;
+    while( stack.try_pop(i) )
     {
-        try
-        {
-            int i = stack.pop();
-            if ( i == 1 )
-            {
-                ++pop1;
-            }
-            else if( i == 2 )
-                ++pop2;
-            ++times;
-        } catch (cxx_utils::concurrent::lfstack_pop_empty &e)
+        if ( i == 1 )
         {
-            return;
+            ++c.pop1;
         }
+        else if( i == 2 )
+            ++c.pop2;
+        ++c.times;
     }
 }
 
-int main()
+/// Two pushers fill the stack, two poppers drain it; timed end to end.
+template <class stack_type>
+bool run(const char *pName)
 {
+    stack_type stack;
+    counters c;
+    c.pop1  = 0;
+    c.pop2  = 0;
+    c.times = 0;
 
-    pop1  = 0;
-    pop2  = 0;
-    times = 0;
-    
-    std::thread t1(pusher, 1);
-    std::thread t2(pusher, 2);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+
+    std::thread t1(pusher<stack_type>, std::ref(stack), 1);
+    std::thread t2(pusher<stack_type>, std::ref(stack), 2);
 
     t1.join();
     t2.join();
 
     //
-    std::thread t3(popper);
-    std::thread t4(popper);
+    std::thread t3(popper<stack_type>, std::ref(stack), std::ref(c));
+    std::thread t4(popper<stack_type>, std::ref(stack), std::ref(c));
 
     t3.join();
     t4.join();
 
-    std::cout << "Got " << times << " pops 1(" << pop1 << "), 2(" << pop2 <<
-        ")" << std::endl;
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << pName << ": Got " << c.times << " pops 1(" << c.pop1
+              << "), 2(" << c.pop2 << ") in " << elapsed.count() << " ms"
+              << std::endl;
+
+    return c.times == 2000000 && (c.pop1 == c.pop2) && c.pop1 == 1000000;
+}
+
+/// Throws on the fourth copy out of a range; counts the live copies.
+struct fragile
+{
+    static int s_nLive, s_nCopies;
+    int n;
+
+    explicit fragile(int i) : n(i) { ++s_nLive; }
+    fragile(const fragile &o) : n(o.n)
+    {
+        if( ++s_nCopies == 4 ) throw std::runtime_error("fragile");
+        ++s_nLive;
+    }
+    ~fragile() { --s_nLive; }
+};
+int fragile::s_nLive = 0, fragile::s_nCopies = 0;
+
+/// A push_range that throws part way leaves the stack as it was.
+template <class Reclaim>
+bool check_range_unwind()
+{
+    typedef lfstack<fragile, Reclaim> fragile_stack;
+    bool ok = true;
+    {
+        std::vector<fragile> items;
+        items.reserve(6);
+        for( int i = 0; i < 6; ++i )
+            items.emplace_back(i);
+        fragile_stack stack;
+        stack.emplace(-1);
+        fragile::s_nCopies = 0;
+        try
+        {
+            stack.push_range(items.begin(), items.end());
+            ok = false;
+        }
+        catch (const std::runtime_error &) {}
+        ok = ok && fragile::s_nLive == 7 && stack.pop_all().size() == 1;
+    }
+    return ok && fragile::s_nLive == 0;
+}
+
+/// push_range/pop_n/pop_all: order, counts, and no loss under two threads.
+template <class stack_type>
+bool check_batches(const char *pName)
+{
+    stack_type stack;
+    std::vector<int> items;
+    for( int i = 1; i <= 10; ++i )
+        items.push_back(i);
+
+    stack.push_range(items.begin(), items.end());
+    stack.push(11);
+    bool ok = stack.pop() == 11;
+    {
+        typename stack_type::batch top = stack.pop_n(3);
+        std::vector<int> got(top.begin(), top.end());
+        ok = ok && top.size() == 3 && got[0] == 10 && got[2] == 8;
+    }
+    {
+        typename stack_type::batch rest = stack.pop_all();
+        int expect = 7;
+        for( typename stack_type::batch::iterator it = rest.begin();
+             it != rest.end(); ++it )
+            ok = ok && *it == expect--;
+        ok = ok && rest.size() == 7 && expect == 0 && stack.empty();
+    }
+    ok = ok && stack.pop_n(5).empty() && stack.pop_all().size() == 0;
+
+    // one thread pushes batches of ten while another takes up to 64 at a time
+    std::atomic<long> taken(0), sum(0);
+    std::thread producer([&]() {
+            for( int round = 0; round < 1000; ++round )
+                stack.push_range(items.begin(), items.end());
+        });
+    std::thread consumer([&]() {
+            while( taken < 10000 )
+            {
+                typename stack_type::batch b = stack.pop_n(64);
+                for( typename stack_type::batch::iterator it = b.begin();
+                     it != b.end(); ++it )
+                    sum += *it;
+                taken += b.size();
+            }
+        });
+    producer.join();
+    consumer.join();
+    ok = ok && taken == 10000 && sum == 55 * 1000 && stack.empty();
+    ok = ok && check_range_unwind<typename stack_type::reclaim_policy>();
+
+    std::cout << pName << ": batches " << (ok ? "ok" : "FAILED") << std::endl;
+    return ok;
+}
+
+/// A payload that can be neither copied nor default-constructed.
+struct labelled_buffer
+{
+    std::string sLabel;
+    std::unique_ptr<std::vector<char> > pData;
+
+    labelled_buffer(const std::string &rLabel, std::size_t nSize)
+        : sLabel(rLabel), pData(new std::vector<char>(nSize, 'x')) {}
+    labelled_buffer(labelled_buffer &&o)
+        : sLabel(std::move(o.sLabel)), pData(std::move(o.pData)) {}
+    labelled_buffer &operator=(labelled_buffer &&o)
+    {
+        sLabel = std::move(o.sLabel);
+        pData = std::move(o.pData);
+        return *this;
+    }
+};
+
+/// emplace, push(T&&) and try_pop move payloads through without copies.
+bool check_move_only()
+{
+    typedef std::unique_ptr<std::vector<char> > buffer;
+    lfstack<buffer> buffers;
+    buffer big(new std::vector<char>(1 << 20));
+    const std::vector<char> *pBig = big.get();
+    buffers.push(std::move(big));
+    buffers.emplace(new std::vector<char>(16));
+
+    buffer out;
+    bool ok = !big && buffers.try_pop(out) && out->size() == 16;
+    ok = ok && buffers.pop().get() == pBig && !buffers.try_pop(out) &&
+        out->size() == 16;
+
+    typedef lfstack<labelled_buffer,
+                    cxx_utils::concurrent::hazard_pointer_reclaim> labelled_stack;
+    labelled_stack labelled;
+    labelled.emplace("first", 8);
+    labelled.emplace("second", 4096);
+    labelled_buffer lb("scratch", 0);
+    ok = ok && labelled.try_pop(lb) && lb.sLabel == "second" &&
+        lb.pData->size() == 4096;
+    {
+        labelled_stack::batch rest = labelled.pop_all();
+        labelled_buffer moved(std::move(*rest.begin()));
+        ok = ok && moved.sLabel == "first" && moved.pData->size() == 8;
+    }
+    ok = ok && !labelled.try_pop(lb) && lb.sLabel == "second";
+
+    std::cout << "move-only payloads " << (ok ? "ok" : "FAILED") << std::endl;
+    return ok;
+}
+
+/*
+ * Stacks with static storage outlive the main thread's thread_locals (its
+ * node cache and hazard record); these are used and freed after them.
+ */
+typedef lfstack<int, cxx_utils::concurrent::hazard_pointer_reclaim,
+                cxx_utils::concurrent::pooled_node_allocator> late_stack;
+static late_stack s_lateStack;
+
+struct late_user
+{
+    ~late_user()
+    {
+        for (int i = 1; i <= 300; ++i)
+            s_lateStack.push(i);
+        for (int i = 0; i < 100; ++i)
+            s_lateStack.pop();
+    }
+} static s_lateUser;
+
+int main()
+{
+    using namespace cxx_utils::concurrent;
+
+    // give the main thread a node cache and hazard record to lose at exit
+    s_lateStack.push(1);
+    s_lateStack.pop();
+
+    bool ok = run< lfstack<int> >("heap nodes");
+    ok = run< lfstack<int, tagged_pointer_reclaim, pooled_node_allocator> >
+        ("pooled nodes") && ok;
+    ok = run< lfstack<int, hazard_pointer_reclaim> >
+        ("hazard pointers, heap nodes") && ok;
+    ok = run< lfstack<int, hazard_pointer_reclaim, pooled_node_allocator> >
+        ("hazard pointers, pooled nodes") && ok;
+
+    ok = check_batches< lfstack<int> >("tagged pointers") && ok;
+    ok = check_batches< lfstack<int, hazard_pointer_reclaim> >
+        ("hazard pointers") && ok;
+    ok = check_batches< lfstack<int, tagged_pointer_reclaim,
+                                heap_node_allocator, elimination_backoff<> > >
+        ("elimination") && ok;
+    ok = check_move_only() && ok;
 
-    return (times == 2000000 && (pop1 == pop2) && pop1 == 1000000) ? 0 : 1;
+    return ok ? 0 : 1;
 }
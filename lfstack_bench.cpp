@@ -0,0 +1,112 @@
+#include "lockfree_stack.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace cxx_utils::concurrent;
+
+static const long OPS = 2000000;   ///< push/pop pairs per run, split over threads
+
+/// Every thread pushes and pops in turn; returns million operations/second.
+template <typename stack_type>
+static double run(unsigned threads)
+{
+    stack_type stack;
+    stack.set_throw_configuration(false);
+    for (long i = 1; i <= 64; ++i)
+        stack.push(i);
+
+    std::atomic<bool> go(false);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+        workers.push_back(std::thread([&]() {
+                    while (!go)
+                        std::this_thread::yield();
+                    for (long i = OPS / threads; i > 0; --i) {
+                        stack.push(i);
+                        stack.pop();
+                    }
+                }));
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    go = true;
+    for (unsigned t = 0; t < threads; ++t)
+        workers[t].join();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return 2.0 * (OPS / threads) * threads / elapsed.count() / 1e6;
+}
+
+/// The same traffic as run(), moved 100 items per push_range()/pop_n().
+template <typename stack_type>
+static double run_batches(unsigned threads)
+{
+    enum { BATCH = 100 };
+    stack_type stack;
+    std::vector<long> items(BATCH, 1);
+
+    std::atomic<bool> go(false);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+        workers.push_back(std::thread([&]() {
+                    while (!go)
+                        std::this_thread::yield();
+                    for (long i = OPS / threads / BATCH; i > 0; --i) {
+                        stack.push_range(items.begin(), items.end());
+                        stack.pop_n(BATCH);
+                    }
+                }));
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    go = true;
+    for (unsigned t = 0; t < threads; ++t)
+        workers[t].join();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return 2.0 * (OPS / threads / BATCH * BATCH) * threads /
+        elapsed.count() / 1e6;
+}
+
+/// One line of the table: @pfnRun at 1, 2, 4 ... 64 threads.
+static void row(const char *pName, double (*pfnRun)(unsigned))
+{
+    std::cout << pName;
+    for (unsigned threads = 1; threads <= 64; threads *= 2)
+        std::cout << '\t' << pfnRun(threads);
+    std::cout << std::endl;
+}
+
+template <typename Contention>
+static void scale(const char *pName)
+{
+    typedef lfstack<long, tagged_pointer_reclaim, pooled_node_allocator,
+                    Contention> stack_type;
+    row(pName, &run<stack_type>);
+}
+
+int main()
+{
+    std::cout << "Mops/s\t";
+    for (unsigned threads = 1; threads <= 64; threads *= 2)
+        std::cout << '\t' << threads;
+    std::cout << std::endl;
+
+    // the default policies: tagged pointers over heap nodes
+    row("default", &run< lfstack<long> >);
+    scale<no_backoff>("no backoff");
+    scale<exponential_backoff>("exponential");
+    scale< elimination_backoff<> >("elimination");
+
+    row("batches of 100, default", &run_batches< lfstack<long> >);
+    row("batches of 100, hazard",
+        &run_batches< lfstack<long, hazard_pointer_reclaim> >);
+    row("batches of 100, pooled",
+        &run_batches< lfstack<long, tagged_pointer_reclaim,
+                              pooled_node_allocator> >);
+    return 0;
+}
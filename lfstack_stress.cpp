@@ -0,0 +1,161 @@
+#include "lockfree_stack.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+using cxx_utils::concurrent::lfstack;
+
+// Live heap bytes in the whole process: every node the stack holds on to,
+// in use, free-listed, pooled or waiting on a hazard, is in here. Counting
+// bytes rather than blocks sees each node of a pooled slab.
+static std::atomic<long> live_bytes(0);
+
+static const std::size_t HEADER = 16;  // keeps malloc's alignment
+
+void *operator new(std::size_t size)
+{
+    if (char *p = static_cast<char *>(std::malloc(size + HEADER))) {
+        *reinterpret_cast<std::size_t *>(p) = size;
+        live_bytes += long(size);
+        return p + HEADER;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    if (!p)
+        return;
+    char *block = static_cast<char *>(p) - HEADER;
+    live_bytes -= long(*reinterpret_cast<std::size_t *>(block));
+    std::free(block);
+}
+
+/// Most items ever waiting on the stack; pushers hold off above it.
+static const long LIMIT = 10000;
+
+/// Heap bytes per node: a bare node, or a pooled one padded to a cache line.
+static long node_bytes(bool bPooled)
+{
+    return bPooled ? 64 : long(sizeof(void *) + sizeof(long));
+}
+
+template <typename stack_type>
+static bool stress(const char *pName, double seconds, unsigned pushers,
+                   unsigned poppers)
+{
+    const long per_node = node_bytes(
+        std::is_same<typename stack_type::allocator_policy,
+                     cxx_utils::concurrent::pooled_node_allocator>::value);
+    const long baseline = live_bytes;
+    bool ok = true;
+    {
+        stack_type stack;
+        stack.set_throw_configuration(false);
+        std::atomic<long> outstanding(0);
+        std::atomic<bool> stop(false);
+        std::atomic<long> pushed(0), popped(0), pushed_sum(0), popped_sum(0);
+        std::vector<std::thread> threads;
+
+        for (unsigned i = 0; i < pushers; ++i)
+            threads.push_back(std::thread([&, i]() {
+                        long n = 0, sum = 0;
+                        for (long v = i + 1; !stop.load(std::memory_order_relaxed);
+                             v += pushers) {
+                            if (outstanding.fetch_add(1) >= LIMIT) {
+                                --outstanding;
+                                std::this_thread::yield();
+                                continue;
+                            }
+                            stack.push(v);
+                            ++n;
+                            sum += v;
+                        }
+                        pushed += n;
+                        pushed_sum += sum;
+                    }));
+        std::atomic<unsigned> pushers_left(pushers);
+        for (unsigned i = 0; i < poppers; ++i)
+            threads.push_back(std::thread([&]() {
+                        long n = 0, sum = 0;
+                        for (;;) {
+                            long v = stack.pop();
+                            if (v) {
+                                --outstanding;
+                                ++n;
+                                sum += v;
+                            } else if (stop && pushers_left == 0) {
+                                break;
+                            } else {
+                                std::this_thread::yield();
+                            }
+                        }
+                        popped += n;
+                        popped_sum += sum;
+                    }));
+
+        // the hazard records and thread stacks settle in the first moments
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        long peak = 0;
+        const std::chrono::steady_clock::time_point end =
+            std::chrono::steady_clock::now() +
+            std::chrono::milliseconds(long(seconds * 1000));
+        while (std::chrono::steady_clock::now() < end) {
+            peak = std::max(peak, (live_bytes - baseline) / per_node);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        stop = true;
+        for (unsigned i = 0; i < pushers; ++i)
+            threads[i].join();
+        pushers_left = 0;
+        for (unsigned i = pushers; i < threads.size(); ++i)
+            threads[i].join();
+
+        /* every node the stack keeps, plus a hazard backlog, a magazine
+         * pair or a partly used slab per thread */
+        const long bound = LIMIT + long(pushers + poppers + 2) * 256 + 1024;
+        std::cout << pName << ": " << popped << " pops, peak " << peak
+                  << " live nodes (bound " << bound << ")" << std::endl;
+        ok = popped == pushed && popped_sum == pushed_sum && stack.empty() &&
+            peak <= bound;
+    }
+    if (!ok)
+        std::cout << pName << ": FAILED" << std::endl;
+    return ok;
+}
+
+/**
+ * stress_lfstack [seconds [pushers [poppers]]]: runs each reclaim and
+ * allocation policy pair, and elimination on top of both, for @seconds.
+ * Fails if any item is lost or duplicated, or if the heap grows past the
+ * nodes the stack can legitimately hold.
+ */
+int main(int argc, char **argv)
+{
+    const double seconds = argc > 1 ? std::atof(argv[1]) : 2.0;
+    const unsigned pushers = argc > 2 ? std::atoi(argv[2]) : 4;
+    const unsigned poppers = argc > 3 ? std::atoi(argv[3]) : 4;
+
+    using namespace cxx_utils::concurrent;
+    bool ok = stress< lfstack<long, tagged_pointer_reclaim> >
+        ("tagged pointer", seconds, pushers, poppers);
+    ok = stress< lfstack<long, hazard_pointer_reclaim> >
+        ("hazard pointer", seconds, pushers, poppers) && ok;
+    ok = stress< lfstack<long, tagged_pointer_reclaim, pooled_node_allocator> >
+        ("tagged pointer, pooled", seconds, pushers, poppers) && ok;
+    ok = stress< lfstack<long, hazard_pointer_reclaim, pooled_node_allocator> >
+        ("hazard pointer, pooled", seconds, pushers, poppers) && ok;
+    ok = stress< lfstack<long, tagged_pointer_reclaim, pooled_node_allocator,
+                         elimination_backoff<> > >
+        ("tagged pointer, pooled, elimination", seconds, pushers, poppers) && ok;
+    ok = stress< lfstack<long, hazard_pointer_reclaim, heap_node_allocator,
+                         elimination_backoff<> > >
+        ("hazard pointer, elimination", seconds, pushers, poppers) && ok;
+    return ok ? 0 : 1;
+}
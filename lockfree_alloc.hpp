@@ -0,0 +1,260 @@
+// "cyclic_iterator" -*- C++ -*-
+
+// Copyright (C) 2015 Aaron Conole
+//
+// This file is governed by the 'use this freely' common-sense license
+// This means the following:
+// - Take this header
+// - #include it in your project (commercial, or non)
+// - ???
+// - profit
+
+/** @file lockfree_alloc.hpp
+ * Node allocation policies for lfstack.
+ *
+ * - heap_node_allocator: new and delete for every node.
+ *
+ * - pooled_node_allocator: each thread keeps a private list of free nodes
+ *   (its magazine). Push and pop touch only that list. A thread that
+ *   frees more nodes than it allocates (a consumer) hands them, a
+ *   magazine at a time, to a shared lock-free depot. A thread that runs
+ *   dry (a producer) takes a whole magazine back from it. The heap is
+ *   only used to carve new slabs when the depot is empty too. Nodes are
+ *   padded to a cache line so two threads never share one.
+ *
+ * The pool never gives memory back; it is bounded by the peak number of
+ * nodes of each type. Because a freed node's memory stays a node,
+ * tagged_pointer_reclaim can hand popped nodes straight back to the pool
+ * (type_stable) rather than keeping its own free list.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <cstddef>
+#include <stdint.h>
+
+#include "lockfree_reclaim.hpp"
+
+#ifndef LOCK_FREE_ALLOC__H
+#define LOCK_FREE_ALLOC__H
+
+namespace cxx_utils
+{
+    namespace concurrent
+    {
+        namespace detail
+        {
+            /**
+             * The process-wide pool of @Node objects. Nodes are constructed
+             * once, when their slab is carved, and linked through their own
+             * next member while free.
+             */
+            template<typename Node>
+            class node_pool
+            {
+            public:
+                enum
+                {
+                    CACHE_LINE = 64,
+                    MAGAZINE   = 64,          ///< nodes moved to/from the depot at once
+                    SLAB       = 4 * MAGAZINE ///< nodes carved per heap call
+                };
+
+            private:
+                /** A chain of free nodes parked in the depot. */
+                struct magazine
+                {
+                    std::atomic<magazine*> next;
+                    Node                  *pNodes;
+                    magazine() : next(0), pNodes(0) {}
+                };
+
+                /**
+                 * The calling thread's free nodes; whatever is left goes to
+                 * the depot when it is destroyed.
+                 */
+                struct thread_cache
+                {
+                    Node        *pNodes;
+                    std::size_t  nCount;
+
+                    thread_cache() : pNodes(0), nCount(0) {}
+                    ~thread_cache()
+                    {
+                        node_pool &pool = instance();
+                        while( pNodes )
+                            pool.spill(*this, nCount < MAGAZINE ? nCount
+                                       : std::size_t(MAGAZINE));
+                    }
+                };
+
+                /** The thread_local one; once it is gone, local() returns 0. */
+                struct own_cache : thread_cache
+                {
+                    ~own_cache() { cache_gone() = true; }
+                };
+
+                tagged_head<magazine> m_full;
+                char                  m_pad[CACHE_LINE];
+                tagged_head<magazine> m_empty;
+
+                node_pool() {}
+                node_pool(const node_pool &);
+
+                static std::size_t stride()
+                {
+                    return (sizeof(Node) + CACHE_LINE - 1) / CACHE_LINE *
+                        CACHE_LINE;
+                }
+
+                /** Set once thread exit has destroyed the calling thread's cache. */
+                static bool &cache_gone()
+                {
+                    static thread_local bool s_bGone = false;
+                    return s_bGone;
+                }
+
+                /**
+                 * The calling thread's cache, or 0 after thread exit: the
+                 * main thread's thread_locals are destroyed before static
+                 * stacks, which then go through the depot one node at a time.
+                 */
+                static thread_cache *local()
+                {
+                    if( cache_gone() ) return 0;
+                    static thread_local own_cache s_cache;
+                    return &s_cache;
+                }
+
+                static Node *take(thread_cache &rCache)
+                {
+                    Node *n = rCache.pNodes;
+                    rCache.pNodes = n->next.load(std::memory_order_relaxed);
+                    --rCache.nCount;
+                    return n;
+                }
+
+                void give(thread_cache &rCache, Node *pNode)
+                {
+                    pNode->next.store(rCache.pNodes, std::memory_order_relaxed);
+                    rCache.pNodes = pNode;
+                    if( ++rCache.nCount >= 2 * MAGAZINE )
+                        spill(rCache, MAGAZINE);
+                }
+
+                /** Moves @nCount nodes from @rCache to the depot. */
+                void spill(thread_cache &rCache, std::size_t nCount)
+                {
+                    magazine *mag = m_empty.pop();
+                    if( !mag ) mag = new magazine;
+                    Node *first = rCache.pNodes, *last = first;
+                    for( std::size_t i = 1; i < nCount; ++i )
+                        last = last->next.load(std::memory_order_relaxed);
+                    rCache.pNodes = last->next.load(std::memory_order_relaxed);
+                    rCache.nCount -= nCount;
+                    last->next.store(0, std::memory_order_relaxed);
+                    mag->pNodes = first;
+                    m_full.push(mag, mag);
+                }
+
+                /** Refills an empty @rCache from the depot or a new slab. */
+                void refill(thread_cache &rCache)
+                {
+                    if( magazine *mag = m_full.pop() )
+                    {
+                        std::size_t n = 0;
+                        for( Node *p = mag->pNodes; p;
+                             p = p->next.load(std::memory_order_relaxed) )
+                            ++n;
+                        rCache.pNodes = mag->pNodes;
+                        rCache.nCount = n;
+                        mag->pNodes = 0;
+                        m_empty.push(mag, mag);
+                        return;
+                    }
+
+                    const std::size_t size = stride();
+                    char *raw = static_cast<char*>(
+                        ::operator new(size * SLAB + CACHE_LINE));
+                    char *base = raw + (CACHE_LINE - uintptr_t(raw) % CACHE_LINE);
+                    for( std::size_t i = SLAB; i-- > 0; )
+                    {
+                        Node *n = new (base + i * size) Node;
+                        n->next.store(rCache.pNodes, std::memory_order_relaxed);
+                        rCache.pNodes = n;
+                    }
+                    rCache.nCount = SLAB;
+                }
+
+            public:
+                /* never destroyed: stacks with static storage may still
+                 * free nodes while the program exits */
+                static node_pool &instance()
+                {
+                    static node_pool *s_pool = new node_pool;
+                    return *s_pool;
+                }
+
+                Node *allocate()
+                {
+                    thread_cache *cache = local();
+                    if( !cache )
+                    {
+                        // the rest goes back to the depot with @late
+                        thread_cache late;
+                        refill(late);
+                        return take(late);
+                    }
+                    if( !cache->pNodes ) refill(*cache);
+                    return take(*cache);
+                }
+
+                void deallocate(Node *pNode)
+                {
+                    thread_cache *cache = local();
+                    if( !cache )
+                    {
+                        thread_cache late;  // hands @pNode to the depot
+                        give(late, pNode);
+                        return;
+                    }
+                    give(*cache, pNode);
+                }
+            };
+        }
+
+        /** A fresh heap node per push; the reference behaviour. */
+        struct heap_node_allocator
+        {
+            static const bool type_stable = false;
+
+            template<typename Node>
+            static Node *allocate() { return new Node; }
+
+            template<typename Node>
+            static void deallocate(Node *pNode) { delete pNode; }
+        };
+
+        /** Per-thread magazines over a shared depot; see above. */
+        struct pooled_node_allocator
+        {
+            static const bool type_stable = true;
+
+            template<typename Node>
+            static Node *allocate()
+            {
+                return detail::node_pool<Node>::instance().allocate();
+            }
+
+            template<typename Node>
+            static void deallocate(Node *pNode)
+            {
+                detail::node_pool<Node>::instance().deallocate(pNode);
+            }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,192 @@
+// "cyclic_iterator" -*- C++ -*-
+
+// Copyright (C) 2015 Aaron Conole
+//
+// This file is governed by the 'use this freely' common-sense license
+// This means the following:
+// - Take this header
+// - #include it in your project (commercial, or non)
+// - ???
+// - profit
+
+/** @file lockfree_backoff.hpp
+ * Contention policies for lfstack.
+ *
+ * lfstack makes one attempt on its head at a time. When the CAS loses to
+ * another thread it asks the policy what to do before the next attempt:
+ *
+ * - no_backoff retries immediately.
+ * - exponential_backoff spins for twice as long after each failure, and
+ *   yields the CPU once the spin grows long.
+ * - elimination_backoff<> first tries to meet an operation of the other
+ *   kind in a small array of slots. A push that collides with a pop hands
+ *   its node over directly and neither touches the head; this is the
+ *   scheme of Hendler, Shavit and Yerushalmi. Only pushers wait in a
+ *   slot; a popper looks into one slot and takes whatever node is parked
+ *   there. A push_range() chain is never parked, so it only backs off.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <stdint.h>
+
+#ifndef LOCK_FREE_BACKOFF__H
+#define LOCK_FREE_BACKOFF__H
+
+namespace cxx_utils
+{
+    namespace concurrent
+    {
+        namespace detail
+        {
+            inline void cpu_relax()
+            {
+#if defined(__x86_64__) || defined(__i386__)
+                __builtin_ia32_pause();
+#else
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+            }
+
+            /** Waits 2^@nAttempt pauses; past 2^10 gives the CPU away. */
+            inline void backoff(unsigned int nAttempt)
+            {
+                enum { MAX_SPIN_SHIFT = 10 };
+                if( nAttempt > MAX_SPIN_SHIFT )
+                {
+                    std::this_thread::yield();
+                    return;
+                }
+                for( unsigned int i = 1u << nAttempt; i; --i )
+                    cpu_relax();
+            }
+
+            /** A cheap per-thread xorshift, for spreading threads over slots. */
+            inline uint32_t thread_random()
+            {
+                static thread_local uint32_t s_state = 0;
+                if( !s_state )
+                    s_state = uint32_t(uintptr_t(&s_state) >> 4) | 1;
+                s_state ^= s_state << 13;
+                s_state ^= s_state >> 17;
+                s_state ^= s_state << 5;
+                return s_state;
+            }
+        }
+
+        struct no_backoff
+        {
+            template<typename Node>
+            class arena
+            {
+            public:
+                /** True if @pNode was taken by a pop and the push is done. */
+                bool push_collided(Node *, unsigned int &) { return false; }
+
+                /** A node taken from a colliding push, or 0. */
+                Node *pop_collided(unsigned int &) { return 0; }
+
+                /** After a failed push of a whole chain, which can't be handed off. */
+                void chain_collided(unsigned int &) {}
+            };
+        };
+
+        struct exponential_backoff
+        {
+            template<typename Node>
+            class arena
+            {
+            public:
+                bool push_collided(Node *, unsigned int &rAttempt)
+                {
+                    detail::backoff(rAttempt++);
+                    return false;
+                }
+
+                Node *pop_collided(unsigned int &rAttempt)
+                {
+                    detail::backoff(rAttempt++);
+                    return 0;
+                }
+
+                void chain_collided(unsigned int &rAttempt)
+                {
+                    detail::backoff(rAttempt++);
+                }
+            };
+        };
+
+        template<unsigned int Slots = 8>
+        struct elimination_backoff
+        {
+            template<typename Node>
+            class arena
+            {
+                /* a slot is 0, a parked pusher's node, or TAKEN until that
+                 * pusher notices; only the pusher empties it again, so a
+                 * recycled node can't be mistaken for the one parked */
+                struct slot
+                {
+                    std::atomic<Node*> pNode;
+                    char               pad[64 - sizeof(std::atomic<Node*>)];
+                    slot() : pNode(0) {}
+                };
+
+                slot m_slots[Slots];
+
+                static Node *taken() { return reinterpret_cast<Node*>(uintptr_t(1)); }
+
+                slot &pick() { return m_slots[detail::thread_random() % Slots]; }
+
+            public:
+                bool push_collided(Node *pNode, unsigned int &rAttempt)
+                {
+                    slot &s = pick();
+                    Node *empty = 0;
+                    if( !s.pNode.compare_exchange_strong(empty, pNode,
+                                                         std::memory_order_release,
+                                                         std::memory_order_relaxed) )
+                    {
+                        detail::backoff(rAttempt++);
+                        return false;
+                    }
+
+                    detail::backoff(rAttempt++);
+                    Node *mine = pNode;
+                    if( s.pNode.compare_exchange_strong(mine, 0,
+                                                        std::memory_order_relaxed,
+                                                        std::memory_order_relaxed) )
+                        return false;
+
+                    // a popper took it
+                    s.pNode.store(0, std::memory_order_relaxed);
+                    return true;
+                }
+
+                Node *pop_collided(unsigned int &rAttempt)
+                {
+                    slot &s = pick();
+                    Node *n = s.pNode.load(std::memory_order_relaxed);
+                    if( n && n != taken() &&
+                        s.pNode.compare_exchange_strong(n, taken(),
+                                                        std::memory_order_acquire,
+                                                        std::memory_order_relaxed) )
+                        return n;
+                    detail::backoff(rAttempt++);
+                    return 0;
+                }
+
+                /* a popper expects one node from a slot, so chains only
+                 * back off */
+                void chain_collided(unsigned int &rAttempt)
+                {
+                    detail::backoff(rAttempt++);
+                }
+            };
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,564 @@
+// "cyclic_iterator" -*- C++ -*-
+
+// Copyright (C) 2015 Aaron Conole
+//
+// This file is governed by the 'use this freely' common-sense license
+// This means the following:
+// - Take this header
+// - #include it in your project (commercial, or non)
+// - ???
+// - profit
+
+/** @file lockfree_reclaim.hpp
+ * Memory reclamation policies for lfstack.
+ *
+ * A policy owns the stack's head and decides when a popped node may be
+ * reused. Two are provided:
+ *
+ * - tagged_pointer_reclaim pairs the head pointer with a counter that
+ *   every successful CAS bumps. A node that is popped and pushed back
+ *   therefore never looks like the old head (no ABA). Popped nodes go to
+ *   a free list, also tagged, and are reused by later pushes. They are
+ *   only deleted with the stack, so a stale read of a node's next pointer
+ *   always touches live memory. Memory is bounded by the stack's peak
+ *   size. On x86-64 this needs cmpxchg16b (build with -mcx16). Without
+ *   it the pair falls back to std::atomic, which may need -latomic.
+ *
+ * - hazard_pointer_reclaim publishes the node a popper is about to read
+ *   in a per-thread hazard slot. Retired nodes are deleted once no slot
+ *   names them. A thread holds at most a fixed number of retired nodes,
+ *   so memory is bounded by the stack size plus that backlog, and is
+ *   returned to the allocator.
+ *
+ * Both hand the policy nodes that have a std::atomic<Node*> next member,
+ * and get node memory from an allocation policy (see lockfree_alloc.hpp).
+ */
+
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+#ifndef LOCK_FREE_RECLAIM__H
+#define LOCK_FREE_RECLAIM__H
+
+namespace cxx_utils
+{
+    namespace concurrent
+    {
+        namespace detail
+        {
+            /**
+             * A stack head paired with a modification counter, swapped as
+             * one double-width word.
+             */
+            template<typename Node>
+            class tagged_head
+            {
+                struct tagged
+                {
+                    Node*     ptr;
+                    uintptr_t tag;
+                };
+
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16) && UINTPTR_MAX == UINT64_MAX
+                typedef unsigned __int128 word_type;
+                union cell
+                {
+                    word_type w;
+                    tagged    t;
+                };
+                cell m_cell __attribute__((aligned(16)));
+
+                /* the halves are read separately; a torn pair just fails
+                 * the CAS that follows */
+                tagged load() const
+                {
+                    tagged t;
+                    t.tag = __atomic_load_n(&m_cell.t.tag, __ATOMIC_ACQUIRE);
+                    t.ptr = __atomic_load_n(&m_cell.t.ptr, __ATOMIC_ACQUIRE);
+                    return t;
+                }
+
+                bool cas(tagged &rExpected, Node *pDesired)
+                {
+                    cell e, d;
+                    e.t = rExpected;
+                    d.t.ptr = pDesired;
+                    d.t.tag = rExpected.tag + 1;
+                    cell prev;
+                    prev.w = __sync_val_compare_and_swap(&m_cell.w, e.w, d.w);
+                    if( prev.w == e.w ) return true;
+                    rExpected = prev.t;
+                    return false;
+                }
+            public:
+                tagged_head() { m_cell.w = 0; }
+#else
+                std::atomic<tagged> m_cell;
+
+                tagged load() const
+                {
+                    return m_cell.load(std::memory_order_acquire);
+                }
+
+                bool cas(tagged &rExpected, Node *pDesired)
+                {
+                    tagged d = { pDesired, rExpected.tag + 1 };
+                    return m_cell.compare_exchange_weak(rExpected, d,
+                                                        std::memory_order_acq_rel,
+                                                        std::memory_order_acquire);
+                }
+            public:
+                tagged_head() { tagged t = { 0, 0 }; m_cell.store(t); }
+#endif
+                Node *top() const { return load().ptr; }
+
+                /** Links the private chain @pFirst..@pLast on top. */
+                void push(Node *pFirst, Node *pLast)
+                {
+                    tagged old = load();
+                    do
+                    {
+                        pLast->next.store(old.ptr, std::memory_order_relaxed);
+                    } while( !cas(old, pFirst) );
+                }
+
+                Node *pop()
+                {
+                    tagged old = load();
+                    while( old.ptr &&
+                           !cas(old, old.ptr->next.load(std::memory_order_relaxed)) );
+                    return old.ptr;
+                }
+
+                /** One push attempt; false if another thread got in first. */
+                bool try_push(Node *pFirst, Node *pLast)
+                {
+                    tagged old = load();
+                    pLast->next.store(old.ptr, std::memory_order_relaxed);
+                    return cas(old, pFirst);
+                }
+
+                /**
+                 * One pop attempt; false if another thread got in first,
+                 * otherwise @rpNode is the popped node or 0 when empty.
+                 */
+                bool try_pop(Node *&rpNode)
+                {
+                    tagged old = load();
+                    rpNode = old.ptr;
+                    return !old.ptr ||
+                        cas(old, old.ptr->next.load(std::memory_order_relaxed));
+                }
+
+                /** Detaches the whole chain. */
+                Node *take_all()
+                {
+                    tagged old = load();
+                    while( old.ptr && !cas(old, 0) );
+                    return old.ptr;
+                }
+
+                /**
+                 * Detaches up to @nMax nodes from the top with one CAS and
+                 * stores how many in @rTaken. The walk may read nodes that
+                 * were popped meanwhile, but then the tag has moved on and
+                 * the CAS fails.
+                 */
+                Node *take_n(std::size_t nMax, std::size_t &rTaken)
+                {
+                    rTaken = 0;
+                    tagged old = load();
+                    while( old.ptr && nMax )
+                    {
+                        Node *last = old.ptr;
+                        std::size_t n = 1;
+                        for( Node *nxt; n < nMax &&
+                                 (nxt = last->next.load(std::memory_order_relaxed));
+                             ++n )
+                            last = nxt;
+                        if( cas(old, last->next.load(std::memory_order_relaxed)) )
+                        {
+                            last->next.store(0, std::memory_order_relaxed);
+                            rTaken = n;
+                            return old.ptr;
+                        }
+                    }
+                    return 0;
+                }
+            };
+
+            struct hazard_record
+            {
+                struct retired_node
+                {
+                    void *pNode;
+                    void (*pDelete)(void *);
+                };
+
+                std::atomic<void*> pHazard;
+                std::atomic<bool>  bActive;
+                hazard_record     *pNext;
+                std::vector<retired_node> vRetired;
+                std::vector<void*> vScratch;
+
+                hazard_record() : pHazard(0), bActive(true), pNext(0) {}
+            };
+
+            /**
+             * The process-wide list of hazard records. Records are never
+             * unlinked; a thread that exits leaves its record, and the
+             * nodes it still had retired, to the next thread that starts.
+             */
+            class hazard_domain
+            {
+                std::atomic<hazard_record*> m_pRecords;
+                std::atomic<unsigned int>   m_nRecords;
+
+                hazard_domain() : m_pRecords(0), m_nRecords(0) {}
+                hazard_domain(const hazard_domain &);
+
+            public:
+                /* never destroyed: stacks with static storage may still
+                 * retire nodes while the program exits */
+                static hazard_domain &instance()
+                {
+                    static hazard_domain *s_domain = new hazard_domain;
+                    return *s_domain;
+                }
+
+                hazard_record *acquire_record()
+                {
+                    for( hazard_record *rec = m_pRecords.load(); rec;
+                         rec = rec->pNext )
+                    {
+                        bool inactive = false;
+                        if( rec->bActive.compare_exchange_strong(inactive, true) )
+                            return rec;
+                    }
+                    hazard_record *rec = new hazard_record;
+                    rec->pNext = m_pRecords.load();
+                    while( !m_pRecords.compare_exchange_weak(rec->pNext, rec) );
+                    ++m_nRecords;
+                    return rec;
+                }
+
+                void release_record(hazard_record *pRec)
+                {
+                    pRec->pHazard.store(0, std::memory_order_release);
+                    pRec->bActive.store(false, std::memory_order_release);
+                }
+
+                /** Retired nodes a thread may hold before it must scan. */
+                std::size_t threshold() const
+                {
+                    return std::max<std::size_t>(64, 2 * m_nRecords.load(
+                                                     std::memory_order_relaxed));
+                }
+
+                /** Deletes each of @rRec's retired nodes that no hazard names. */
+                void scan(hazard_record &rRec)
+                {
+                    std::vector<void*> &hazards = rRec.vScratch;
+                    hazards.clear();
+                    for( hazard_record *rec = m_pRecords.load(); rec;
+                         rec = rec->pNext )
+                    {
+                        void *p = rec->pHazard.load();
+                        if( p ) hazards.push_back(p);
+                    }
+                    std::sort(hazards.begin(), hazards.end());
+
+                    std::size_t kept = 0;
+                    for( std::size_t i = 0; i < rRec.vRetired.size(); ++i )
+                    {
+                        const hazard_record::retired_node &r = rRec.vRetired[i];
+                        if( std::binary_search(hazards.begin(), hazards.end(),
+                                               r.pNode) )
+                            rRec.vRetired[kept++] = r;
+                        else
+                            r.pDelete(r.pNode);
+                    }
+                    rRec.vRetired.resize(kept);
+                }
+            };
+
+            /**
+             * The calling thread's hazard record, released at thread exit.
+             * Stacks used after that (from static destructors, say: the
+             * main thread's thread_locals go first) take a record straight
+             * from the domain, which stays theirs; one per thread at most.
+             */
+            inline hazard_record &this_thread_hazard()
+            {
+                // plain pointers and flags outlive the thread's destructors
+                static thread_local hazard_record *s_pRec = 0;
+                static thread_local bool s_bExited = false;
+                struct releaser
+                {
+                    void touch() {}
+                    ~releaser()
+                    {
+                        hazard_domain::instance().release_record(s_pRec);
+                        s_pRec = 0;
+                        s_bExited = true;
+                    }
+                };
+                static thread_local releaser s_releaser;
+
+                if( !s_pRec )
+                {
+                    s_pRec = hazard_domain::instance().acquire_record();
+                    if( !s_bExited ) s_releaser.touch();
+                }
+                return *s_pRec;
+            }
+        }
+
+        /**
+         * ABA protection by a counter CASed together with the head; popped
+         * nodes are kept for reuse until the stack is destroyed, or go
+         * straight back to an allocator that never unmaps them.
+         */
+        struct tagged_pointer_reclaim
+        {
+            template<typename Node, typename Alloc>
+            class stack_head
+            {
+                detail::tagged_head<Node> m_head;
+                char                      m_pad[64];
+                detail::tagged_head<Node> m_free;
+
+            public:
+                stack_head() {}
+                ~stack_head()
+                {
+                    Node *n = m_free.take_all();
+                    while( n )
+                    {
+                        Node *nxt = n->next.load(std::memory_order_relaxed);
+                        Alloc::template deallocate<Node>(n);
+                        n = nxt;
+                    }
+                }
+
+                /** An unlinked node, reused if one is free. */
+                Node *acquire()
+                {
+                    Node *n = Alloc::type_stable ? 0 : m_free.pop();
+                    return n ? n : Alloc::template allocate<Node>();
+                }
+
+                /** A popped node whose value has been destroyed. */
+                void retire(Node *pNode)
+                {
+                    if( Alloc::type_stable )
+                        Alloc::template deallocate<Node>(pNode);
+                    else
+                        m_free.push(pNode, pNode);
+                }
+
+                /** A node from acquire() that was never pushed. */
+                void discard(Node *pNode) { retire(pNode); }
+
+                /**
+                 * @n unlinked nodes chained through next, free ones first:
+                 * one CAS takes as many as the free list can give.
+                 */
+                Node *acquire_chain(std::size_t n)
+                {
+                    std::size_t got = 0;
+                    Node *first = Alloc::type_stable || !n ? 0 :
+                        m_free.take_n(n, got);
+                    for( ; got < n; ++got )
+                    {
+                        Node *p = Alloc::template allocate<Node>();
+                        p->next.store(first, std::memory_order_relaxed);
+                        first = p;
+                    }
+                    return first;
+                }
+
+                /** retire() for the chain @pFirst..@pLast, with one CAS. */
+                void retire_chain(Node *pFirst, Node *pLast)
+                {
+                    if( !Alloc::type_stable )
+                    {
+                        m_free.push(pFirst, pLast);
+                        return;
+                    }
+                    for( Node *n = pFirst, *nxt; ; n = nxt )
+                    {
+                        nxt = n->next.load(std::memory_order_relaxed);
+                        Alloc::template deallocate<Node>(n);
+                        if( n == pLast ) break;
+                    }
+                }
+
+                bool try_push(Node *pFirst, Node *pLast)
+                {
+                    return m_head.try_push(pFirst, pLast);
+                }
+                bool try_pop(Node *&rpNode) { return m_head.try_pop(rpNode); }
+                Node *take_all() { return m_head.take_all(); }
+                Node *take_n(std::size_t nMax, std::size_t &rTaken)
+                {
+                    return m_head.take_n(nMax, rTaken);
+                }
+                bool empty() const { return m_head.top() == 0; }
+
+            private:
+                stack_head(const stack_head &);
+            };
+        };
+
+        /**
+         * ABA and use-after-free protection by per-thread hazard pointers;
+         * popped nodes are deleted once no thread is reading them.
+         */
+        struct hazard_pointer_reclaim
+        {
+            template<typename Node, typename Alloc>
+            class stack_head
+            {
+                std::atomic<Node*> m_head;
+
+                static void delete_node(void *p)
+                {
+                    Alloc::template deallocate<Node>(static_cast<Node*>(p));
+                }
+
+            public:
+                stack_head() : m_head(0) {}
+                ~stack_head()
+                {
+                    /* free what this thread retired; nothing can still be
+                     * reading a stack that is being destroyed */
+                    detail::hazard_domain::instance().scan(
+                        detail::this_thread_hazard());
+                }
+
+                Node *acquire() { return Alloc::template allocate<Node>(); }
+
+                void retire(Node *pNode)
+                {
+                    detail::hazard_record &rec = detail::this_thread_hazard();
+                    detail::hazard_record::retired_node r = { pNode, &delete_node };
+                    rec.vRetired.push_back(r);
+                    detail::hazard_domain &domain = detail::hazard_domain::instance();
+                    if( rec.vRetired.size() >= domain.threshold() )
+                        domain.scan(rec);
+                }
+
+                void discard(Node *pNode) { Alloc::template deallocate<Node>(pNode); }
+
+                Node *acquire_chain(std::size_t n)
+                {
+                    Node *first = 0;
+                    while( n-- )
+                    {
+                        Node *p = Alloc::template allocate<Node>();
+                        p->next.store(first, std::memory_order_relaxed);
+                        first = p;
+                    }
+                    return first;
+                }
+
+                /** retire() for the chain @pFirst..@pLast, with one scan at most. */
+                void retire_chain(Node *pFirst, Node *pLast)
+                {
+                    detail::hazard_record &rec = detail::this_thread_hazard();
+                    for( Node *n = pFirst; ;
+                         n = n->next.load(std::memory_order_relaxed) )
+                    {
+                        detail::hazard_record::retired_node r = { n, &delete_node };
+                        rec.vRetired.push_back(r);
+                        if( n == pLast ) break;
+                    }
+                    detail::hazard_domain &domain = detail::hazard_domain::instance();
+                    if( rec.vRetired.size() >= domain.threshold() )
+                        domain.scan(rec);
+                }
+
+                bool try_push(Node *pFirst, Node *pLast)
+                {
+                    Node *old = m_head.load(std::memory_order_relaxed);
+                    pLast->next.store(old, std::memory_order_relaxed);
+                    return m_head.compare_exchange_strong(old, pFirst,
+                                                          std::memory_order_release,
+                                                          std::memory_order_relaxed);
+                }
+
+                bool try_pop(Node *&rpNode)
+                {
+                    Node *h = m_head.load(std::memory_order_acquire);
+                    rpNode = h;
+                    if( !h ) return true;
+
+                    detail::hazard_record &rec = detail::this_thread_hazard();
+                    rec.pHazard.store(h);
+                    const bool ok = m_head.load() == h &&
+                        m_head.compare_exchange_strong(
+                            h, h->next.load(std::memory_order_relaxed),
+                            std::memory_order_acquire,
+                            std::memory_order_relaxed);
+                    rec.pHazard.store(0, std::memory_order_release);
+                    return ok;
+                }
+
+                Node *take_all()
+                {
+                    return m_head.exchange(0, std::memory_order_acquire);
+                }
+
+                /**
+                 * Walking past the head would need a hazard per node, so
+                 * this detaches everything and pushes back what is over
+                 * @nMax. Until then, concurrent pops see the stack empty.
+                 */
+                Node *take_n(std::size_t nMax, std::size_t &rTaken)
+                {
+                    rTaken = 0;
+                    Node *first = nMax ? take_all() : 0;
+                    if( !first ) return 0;
+
+                    Node *last = first;
+                    rTaken = 1;
+                    for( Node *nxt; rTaken < nMax &&
+                             (nxt = last->next.load(std::memory_order_relaxed));
+                         ++rTaken )
+                        last = nxt;
+                    Node *rest = last->next.load(std::memory_order_relaxed);
+                    last->next.store(0, std::memory_order_relaxed);
+
+                    Node *empty = 0;
+                    if( rest && !m_head.compare_exchange_strong(
+                            empty, rest, std::memory_order_release,
+                            std::memory_order_relaxed) )
+                    {
+                        Node *tail = rest;
+                        for( Node *nxt; (nxt = tail->next.load(
+                                             std::memory_order_relaxed)); )
+                            tail = nxt;
+                        while( !try_push(rest, tail) );
+                    }
+                    return first;
+                }
+
+                bool empty() const
+                {
+                    return m_head.load(std::memory_order_relaxed) == 0;
+                }
+
+            private:
+                stack_head(const stack_head &);
+            };
+        };
+    }
+}
+
+#endif
@@ -16,6 +16,14 @@
 #include <stdint.h>
 #include <stdexcept>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <iterator>
+#include <utility>
+
+#include "lockfree_reclaim.hpp"
+#include "lockfree_alloc.hpp"
+#include "lockfree_backoff.hpp"
 
 #ifndef LOCK_FREE_HEAP_NODE__H
 #define LOCK_FREE_HEAP_NODE__H
@@ -30,25 +38,41 @@ namespace cxx_utils
             ~lfstack_pop_empty() throw() {}
         };
 
-        template<typename T>
+        /**
+         * A lock-free LIFO. @Reclaim decides how popped nodes are kept safe
+         * from ABA and from readers still holding them, @Alloc where node
+         * memory comes from, and @Contention what a push or pop does after
+         * losing a race on the head; see lockfree_reclaim.hpp,
+         * lockfree_alloc.hpp and lockfree_backoff.hpp.
+         */
+        template<typename T, typename Reclaim = tagged_pointer_reclaim,
+                 typename Alloc = heap_node_allocator,
+                 typename Contention = no_backoff>
         class lfstack
         {
+            /* the value lives in raw storage so a reclaim policy can
+             * recycle the node without a T to assign over */
             struct lfstackNode
             {
-                lfstackNode* next;
-                T           val;
+                std::atomic<lfstackNode*> next;
+                typename std::aligned_storage<sizeof(T),
+                                              std::alignment_of<T>::value>::type
+                                          storage;
 
-                lfstackNode(const T &value) : next(0), val(value) { }
+                lfstackNode() : next(0) { }
+                T &val() { return *reinterpret_cast<T*>(&storage); }
             };
 
             typedef lfstackNode* node_pointer;
             typedef lfstackNode  node_type;
-            typedef std::atomic<lfstackNode*> atomic_node_type;
-            typedef std::shared_ptr<node_type> node_shared_pointer;
+            typedef typename Reclaim::template stack_head<node_type, Alloc>
+                                         head_type;
+
+            typedef typename Contention::template arena<node_type>
+                                         arena_type;
 
-            atomic_node_type head;
-            atomic_node_type freelist;
-            std::atomic<unsigned int> pop_counter;
+            head_type  head;
+            arena_type arena;
 
             bool throws_on_empty;
             
@@ -59,123 +83,301 @@ namespace cxx_utils
             typedef const pointer   const_pointer;
             typedef std::size_t     size_type;
             typedef std::size_t     difference_type;
+            typedef Reclaim         reclaim_policy;
+            typedef Alloc           allocator_policy;
+            typedef Contention      contention_policy;
 
-        private:
-
-            void _release_node_chain(node_pointer node)
+            /**
+             * Nodes detached from the stack by pop_all() or pop_n(), in pop
+             * order (most recently pushed first). The batch owns them; the
+             * values are destroyed and the nodes handed back when it goes
+             * away, which must be before the stack does.
+             */
+            class batch
             {
-                while(node)
-                {
-                    node_pointer nxt = node->next;
-                    delete node;
-                    node = nxt;
-                }
-            }
+                friend class lfstack;
 
-            void release_internal_node(node_pointer node)
-            {
-                if (pop_counter == 1)
+                head_type   *pHead;
+                node_pointer pFirst;
+                size_type    nSize;
+
+                batch(head_type *pH, node_pointer pF, size_type nS)
+                    : pHead(pH), pFirst(pF), nSize(nS) {}
+                batch(const batch &);
+                batch &operator=(const batch &);
+
+            public:
+                class iterator : public std::iterator<std::forward_iterator_tag, T>
                 {
-                    node_pointer dnodes = freelist.exchange(nullptr);
-                    if(!--pop_counter)
+                    node_pointer pNode;
+                public:
+                    explicit iterator(node_pointer p = 0) : pNode(p) {}
+                    T &operator*() const { return pNode->val(); }
+                    T *operator->() const { return &pNode->val(); }
+                    iterator &operator++()
                     {
-                        /* this was the only release thread - just delete*/
-                        _release_node_chain(dnodes);
+                        pNode = pNode->next.load(std::memory_order_relaxed);
+                        return *this;
                     }
-                    else if (dnodes)
+                    iterator operator++(int)
                     {
-                        /* re-enqueue on the freelist */
-                        node_pointer listnode = dnodes;
-                        while(listnode)
-                        {
-                            node_pointer nxt = listnode->next;
-                            do
-                            {
-                                listnode->next = freelist.load();
-                            }while(!freelist.compare_exchange_weak(listnode->next, listnode));
-                            listnode = nxt;
-                        }
+                        iterator old(*this);
+                        ++*this;
+                        return old;
                     }
-                    delete node;
+                    bool operator==(const iterator &o) const { return pNode == o.pNode; }
+                    bool operator!=(const iterator &o) const { return pNode != o.pNode; }
+                };
+
+                batch(batch &&o) : pHead(o.pHead), pFirst(o.pFirst), nSize(o.nSize)
+                {
+                    o.pFirst = 0;
+                    o.nSize = 0;
                 }
-                else
+
+                ~batch()
                 {
-                    do
+                    if( !pFirst ) return;
+                    node_pointer last = pFirst;
+                    for( node_pointer p = pFirst; p;
+                         p = p->next.load(std::memory_order_relaxed) )
                     {
-                        node->next = freelist.load();
-                    }while(!freelist.compare_exchange_weak(node->next, node));
-                    --pop_counter;
+                        p->val().~T();
+                        last = p;
+                    }
+                    pHead->retire_chain(pFirst, last);
                 }
+
+                iterator begin() const { return iterator(pFirst); }
+                iterator end() const { return iterator(); }
+                size_type size() const { return nSize; }
+                bool empty() const { return pFirst == 0; }
+            };
+
+        private:
+
+            node_pointer _pop_node()
+            {
+                node_pointer front;
+                unsigned int attempt = 0;
+                while( !head.try_pop(front) )
+                    if( (front = arena.pop_collided(attempt)) )
+                        break;
+                return front;
             }
 
-            /**
-             * @brief Internal routine to pop element from HEAD and replace
-             * head with the 'next' value
-             */
-            node_pointer _pop_front()
+            void _push_node(node_pointer node)
             {
-                node_pointer old_head = head.load();
-                while(old_head &&
-                      !head.compare_exchange_weak(old_head, old_head->next,
-                                                  std::memory_order_release,
-                                                  std::memory_order_relaxed));
-                
-                return old_head;
+                unsigned int attempt = 0;
+                while( !head.try_push(node, node) &&
+                       !arena.push_collided(node, attempt) );
             }
-            
+
+            void _push_chain(node_pointer top, node_pointer bottom)
+            {
+                unsigned int attempt = 0;
+                while( !head.try_push(top, bottom) )
+                    arena.chain_collided(attempt);
+            }
+
+            /** Destroys a popped node's value and retires it, even on a throw. */
+            struct popped_node
+            {
+                head_type   &rHead;
+                node_pointer pNode;
+
+                popped_node(head_type &h, node_pointer p) : rHead(h), pNode(p) {}
+                ~popped_node()
+                {
+                    pNode->val().~T();
+                    rHead.retire(pNode);
+                }
+            };
+
             bool _do_pop_front(T &result)
             {
-                bool ret = false;
-                ++pop_counter; /* released in release_internal_node */
+                node_pointer front = _pop_node();
+                if( !front )
+                    return false;
+
+                popped_node guard(head, front);
+                result = std::move(front->val());
+                return true;
+            }
+
+            /** Hands back the unused chain @pSpare from acquire_chain(). */
+            void _discard_chain(node_pointer pSpare)
+            {
+                if( !pSpare ) return;
+                node_pointer last = pSpare;
+                for( node_pointer nxt; (nxt = last->next.load(
+                                            std::memory_order_relaxed)); )
+                    last = nxt;
+                head.retire_chain(pSpare, last);
+            }
 
-                node_pointer front = _pop_front();
-                if( front )
+            /** Builds the chain one acquire() at a time; the length is unknown. */
+            template<typename InputIterator>
+            void _push_range(InputIterator first, InputIterator last,
+                             std::input_iterator_tag)
+            {
+                node_pointer top = 0, bottom = 0;
+                try
+                {
+                    for( ; first != last; ++first )
+                    {
+                        node_pointer n = _new_node(*first);
+                        n->next.store(top, std::memory_order_relaxed);
+                        if( !bottom ) bottom = n;
+                        top = n;
+                    }
+                }
+                catch (...)
                 {
-                    result = front->val;
-                    release_internal_node(front);
-                    ret = true;
+                    batch unpushed(&head, top, 0);
+                    throw;
                 }
-                return ret;
+                if( top ) _push_chain(top, bottom);
             }
-            
-            void _push_front(const value_type& val)
+
+            /** Takes every node up front with one acquire_chain(). */
+            template<typename ForwardIterator>
+            void _push_range(ForwardIterator first, ForwardIterator last,
+                             std::forward_iterator_tag)
             {
-                node_pointer newhead = new node_type(val);
+                const size_type count = size_type(std::distance(first, last));
+                if( !count ) return;
 
-                do
+                node_pointer spare = head.acquire_chain(count);
+                node_pointer top = 0, bottom = 0;
+                try
+                {
+                    for( ; first != last; ++first )
+                    {
+                        node_pointer n = spare;
+                        new (&n->storage) T(*first);
+                        spare = n->next.load(std::memory_order_relaxed);
+                        n->next.store(top, std::memory_order_relaxed);
+                        if( !bottom ) bottom = n;
+                        top = n;
+                    }
+                }
+                catch (...)
                 {
-                    newhead->next = head.load(std::memory_order_relaxed);
-                }while(!head.compare_exchange_weak(newhead->next, newhead,
-                                                   std::memory_order_release,
-                                                   std::memory_order_relaxed));
+                    batch unpushed(&head, top, 0);
+                    _discard_chain(spare);
+                    throw;
+                }
+                _push_chain(top, bottom);
+            }
+
+            /** An unlinked node holding T(@args...). */
+            template<typename... Args>
+            node_pointer _new_node(Args&&... args)
+            {
+                node_pointer n = head.acquire();
+                try
+                {
+                    new (&n->storage) T(std::forward<Args>(args)...);
+                }
+                catch (...)
+                {
+                    head.discard(n);
+                    throw;
+                }
+                return n;
             }
             
         public:
             void clear()
             {
-                T tmp = T();
-                bool throwval = throws_on_empty;
-                throws_on_empty = false;
-                while ( !empty() && _do_pop_front(tmp) );
-                throws_on_empty = throwval;
+                pop_all();
+            }
+
+            /**
+             * Pushes [first, last) as if one element at a time, so *(last-1)
+             * ends up on top, but splices them on with a single CAS. With
+             * forward iterators the nodes are also taken from the reclaim
+             * policy in one go.
+             */
+            template<typename InputIterator>
+            void push_range(InputIterator first, InputIterator last)
+            {
+                _push_range(first, last, typename std::iterator_traits
+                            <InputIterator>::iterator_category());
+            }
+
+            /** Detaches every element in one atomic operation. */
+            batch pop_all()
+            {
+                node_pointer first = head.take_all();
+                size_type n = 0;
+                for( node_pointer p = first; p;
+                     p = p->next.load(std::memory_order_relaxed) )
+                    ++n;
+                return batch(&head, first, n);
+            }
+
+            /** Detaches at most @n elements from the top in one operation. */
+            batch pop_n(size_type n)
+            {
+                size_type taken;
+                node_pointer first = head.take_n(n, taken);
+                return batch(&head, first, taken);
+            }
+
+            /** Constructs the new top in place from @args. */
+            template<typename... Args>
+            void emplace(Args&&... args)
+            {
+                _push_node(_new_node(std::forward<Args>(args)...));
             }
 
             void push_front(const T &type)
             {
-                _push_front( type );
+                emplace( type );
+            }
+
+            void push_front(T &&type)
+            {
+                emplace( std::move(type) );
             }
 
             void push(const T& type)
             {
-                _push_front( type );
+                emplace( type );
             }
-            
+
+            void push(T &&type)
+            {
+                emplace( std::move(type) );
+            }
+
+            /**
+             * Moves the top into @result and returns true, or returns false
+             * when the stack is empty. Never throws lfstack_pop_empty, and
+             * needs neither a copyable nor a default-constructible T.
+             */
+            bool try_pop(T &result)
+            {
+                return _do_pop_front(result);
+            }
+
+            /**
+             * The top, moved out. An empty stack throws lfstack_pop_empty,
+             * or returns T() if throwing is configured off.
+             */
             T pop_front()
             {
-                T result = T();
-                if (!_do_pop_front(result) && throws_on_empty)
-                    throw lfstack_pop_empty();
-                return result;
+                node_pointer front = _pop_node();
+                if( !front )
+                {
+                    if( throws_on_empty )
+                        throw lfstack_pop_empty();
+                    return T();
+                }
+                popped_node guard(head, front);
+                return std::move(front->val());
             }
 
             T pop()
@@ -183,12 +385,12 @@ namespace cxx_utils
                 return pop_front();
             }
             
-            bool empty(){ return head.load(std::memory_order_relaxed) == 0; }
+            bool empty(){ return head.empty(); }
 
             bool get_throw_configuration() { return throws_on_empty; }
             void set_throw_configuration(bool throws) { throws_on_empty = throws; }
             
-            lfstack() : head(0), freelist(0), pop_counter(0), throws_on_empty(true) {}
+            lfstack() : head(), throws_on_empty(true) {}
             ~lfstack(){ clear(); }
         };
     }
@@ -0,0 +1,225 @@
+// "mmap_buffer" -*- C++ -*-
+
+// Copyright (C) 2014 Aaron Conole
+//
+// This file is governed by the 'use this freely' common-sense license
+// This means the following:
+// - Take this header
+// - #include it in your project (commercial, or non)
+// - ???
+// - profit
+
+/** @file mmap_buffer.hpp
+ * Read-only memory-mapped file streambuf
+ */
+
+#pragma once
+
+#include <streambuf>
+#include <algorithm>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef __MMAP_BUFFER__H__
+#define __MMAP_BUFFER__H__
+
+namespace cxx_utils
+{
+    namespace io
+    {
+        /**
+         * \brief A read-only streambuf over a memory-mapped regular file.
+         *
+         * The mapping itself is the get area, so reading through an
+         * istream copies straight from the page cache, and the data in
+         * [eback(), egptr()) can be parsed in place. By default the whole
+         * file is mapped; with a window size only that much is mapped at a
+         * time and the window slides forward as it is consumed, for files
+         * too big to map whole. Seeking (in either mode) just moves the get
+         * pointer, remapping only when it leaves the window.
+         *
+         * The file is assumed not to shrink while mapped; reading a page
+         * cut off by a truncation raises SIGBUS, as with any mmap reader.
+         */
+        class mmap_buffer : public std::streambuf
+        {
+        public:
+            /**
+             * Maps the file open on @nFileDes. @nWindow of 0 maps it whole,
+             * otherwise it is rounded up to whole pages.
+             */
+            explicit mmap_buffer(int nFileDes, bool bOwner = true,
+                                 std::size_t nWindow = 0)
+                : m_nFileDes(nFileDes), m_bOwner(bOwner)
+            {
+                init(nWindow);
+            }
+
+            explicit mmap_buffer(const char *pPath, std::size_t nWindow = 0)
+                : m_nFileDes(::open(pPath, O_RDONLY | O_CLOEXEC)),
+                  m_bOwner(true)
+            {
+                init(nWindow);
+            }
+
+            virtual ~mmap_buffer()
+            {
+                unmap();
+                if( m_nFileDes != -1 && m_bOwner ) ::close(m_nFileDes);
+            }
+
+            /// False when the file couldn't be opened or isn't mappable.
+            bool is_open() const { return m_bMappable; }
+
+            /// Length of the file in bytes.
+            std::uint64_t size() const { return m_nFileSize; }
+
+        protected:
+            virtual std::streambuf::int_type underflow()
+            {
+                if( gptr() < egptr() )
+                    return traits_type::to_int_type(*gptr());
+                if( !map_at(m_nMapOffset + (egptr() - eback())) )
+                    return traits_type::eof();
+                return traits_type::to_int_type(*gptr());
+            }
+
+            virtual std::streamsize showmanyc()
+            {
+                const std::uint64_t pos = position();
+                return pos < m_nFileSize ?
+                    std::streamsize(m_nFileSize - pos) : -1;
+            }
+
+            virtual std::streambuf::pos_type
+            seekoff(std::streambuf::off_type off, std::ios_base::seekdir dir,
+                    std::ios_base::openmode which)
+            {
+                std::int64_t base;
+                switch( dir )
+                {
+                case std::ios_base::beg: base = 0; break;
+                case std::ios_base::cur: base = std::int64_t(position()); break;
+                default: base = std::int64_t(m_nFileSize); break;
+                }
+                return seekpos(std::streambuf::pos_type(base + off), which);
+            }
+
+            virtual std::streambuf::pos_type
+            seekpos(std::streambuf::pos_type pos, std::ios_base::openmode which)
+            {
+                const std::streambuf::pos_type fail =
+                    std::streambuf::pos_type(std::streambuf::off_type(-1));
+                const std::streambuf::off_type target = pos;
+                if( !m_bMappable || !(which & std::ios_base::in) ||
+                    (which & std::ios_base::out) || target < 0 ||
+                    std::uint64_t(target) > m_nFileSize )
+                    return fail;
+
+                const std::uint64_t abs = std::uint64_t(target);
+                if( eback() && abs >= m_nMapOffset &&
+                    abs <= m_nMapOffset + (egptr() - eback()) )
+                {
+                    setg(eback(), eback() + (abs - m_nMapOffset), egptr());
+                    return pos;
+                }
+                if( abs == m_nFileSize )
+                {
+                    // parked at the end; the next underflow reports eof
+                    unmap();
+                    m_nMapOffset = m_nFileSize;
+                    return pos;
+                }
+                return map_at(abs) ? pos : fail;
+            }
+
+        private:
+            mmap_buffer(const mmap_buffer &);
+            mmap_buffer &operator=(const mmap_buffer &);
+
+            void init(std::size_t nWindow)
+            {
+                m_pMap = 0;
+                m_nMapLen = 0;
+                m_nMapOffset = 0;
+                m_nFileSize = 0;
+                m_bMappable = false;
+                setg(0, 0, 0);
+
+                m_nPage = std::size_t(sysconf(_SC_PAGESIZE));
+                m_nWindow = nWindow ?
+                    (nWindow + m_nPage - 1) / m_nPage * m_nPage : 0;
+
+                struct stat st;
+                if( m_nFileDes == -1 || fstat(m_nFileDes, &st) ||
+                    !S_ISREG(st.st_mode) )
+                    return;
+                m_nFileSize = std::uint64_t(st.st_size);
+                m_bMappable = true;
+            }
+
+            /// Current read position in the file.
+            std::uint64_t position() const
+            {
+                return eback() ? m_nMapOffset + (gptr() - eback())
+                    : m_nMapOffset;
+            }
+
+            void unmap()
+            {
+                if( m_pMap ) ::munmap(m_pMap, m_nMapLen);
+                m_pMap = 0;
+                m_nMapLen = 0;
+                setg(0, 0, 0);
+            }
+
+            /**
+             * Maps the window holding byte @nPos (the whole file when not
+             * windowed) and points the get area at it.
+             */
+            bool map_at(std::uint64_t nPos)
+            {
+                if( !m_bMappable || nPos >= m_nFileSize ) return false;
+
+                std::uint64_t start = 0;
+                std::uint64_t len = m_nFileSize;
+                if( m_nWindow )
+                {
+                    start = nPos / m_nPage * m_nPage;
+                    len = std::min<std::uint64_t>(m_nWindow,
+                                                  m_nFileSize - start);
+                }
+                if( len > std::uint64_t(SIZE_MAX) ) return false;
+
+                unmap();
+                void *map = ::mmap(0, std::size_t(len), PROT_READ, MAP_SHARED,
+                                   m_nFileDes, off_t(start));
+                if( map == MAP_FAILED ) return false;
+                ::madvise(map, std::size_t(len), MADV_SEQUENTIAL);
+                ::madvise(map, std::size_t(len), MADV_WILLNEED);
+
+                m_pMap = map;
+                m_nMapLen = std::size_t(len);
+                m_nMapOffset = start;
+                char *base = static_cast<char *>(map);
+                setg(base, base + (nPos - start), base + len);
+                return true;
+            }
+
+            int           m_nFileDes;
+            bool          m_bOwner;
+            bool          m_bMappable;
+            void         *m_pMap;
+            std::size_t   m_nMapLen;
+            std::uint64_t m_nMapOffset;   ///< file offset of eback()
+            std::uint64_t m_nFileSize;
+            std::size_t   m_nPage;
+            std::size_t   m_nWindow;
+        };
+    }
+}
+#endif
@@ -0,0 +1,79 @@
+#include "mmap_buffer.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+namespace
+{
+    void expect(bool bOk, const char *pWhat)
+    {
+        if( bOk ) return;
+        std::cout << "mmap_buffer: " << pWhat << " FAILED" << std::endl;
+        std::exit(1);
+    }
+}
+
+void check_mmap_buffer()
+{
+    char path[] = "/tmp/cxxutils_mmapXXXXXX";
+    int fd = mkstemp(path);
+    expect(fd != -1, "mkstemp");
+
+    std::string content;
+    for (int i = 0; i < 3000; ++i)
+    {
+        std::ostringstream line;
+        line << "record " << i << '\n';
+        content += line.str();
+    }
+    expect(write(fd, content.data(), content.size()) ==
+           ssize_t(content.size()), "write");
+    close(fd);
+
+    // whole file, then a one page window that has to slide and remap
+    for (std::size_t window = 0; window <= 1; ++window)
+    {
+        cxx_utils::io::mmap_buffer buf(path, window);
+        expect(buf.is_open() && buf.size() == content.size(), "open");
+        std::istream in(&buf);
+
+        std::ostringstream all;
+        all << in.rdbuf();
+        expect(all.str() == content, "sequential read");
+
+        in.clear();
+        in.seekg(content.find("record 2500"));
+        std::string word;
+        int n = 0;
+        expect((in >> word >> n) && n == 2500, "seekg");
+        expect(in.tellg() == std::streampos(content.find("\nrecord 2501")),
+               "tellg");
+
+        in.seekg(-9, std::ios_base::end);
+        std::getline(in, word);
+        expect(word == "ord 2999", "seek from end");
+
+        in.seekg(0);
+        std::getline(in, word);
+        expect(word == "record 0", "seek back to start");
+    }
+
+    unlink(path);
+    std::cout << "mmap_buffer: ok" << std::endl;
+}
+
+namespace cxx_utils_examples
+{
+    class RunTheMmapExamples
+    {
+    public:
+        RunTheMmapExamples(){ check_mmap_buffer(); }
+        ~RunTheMmapExamples(){}
+    };
+
+    static RunTheMmapExamples s_rtmme;
+}
@@ -0,0 +1,287 @@
+#include "streambuf_monitor.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    class recording_callback : public cxx_utils::io::streambuf_callback
+    {
+    public:
+        int nRead, nWrite, nClosed;
+        std::string sData;
+
+        recording_callback() : nRead(0), nWrite(0), nClosed(0) {}
+
+        virtual streambuf_cb_result callback(streambuf_cb_status eStatus,
+                                             std::streambuf *pStreamBuf)
+        {
+            switch( eStatus )
+            {
+            case CB_READ_OK:
+            {
+                ++nRead;
+                // drain what the kernel has, as an edge-triggered reader must
+                char buf[64];
+                std::streamsize n;
+                while( (n = pStreamBuf->in_avail()) > 0 &&
+                       (n = pStreamBuf->sgetn(buf, std::min<std::streamsize>
+                                              (n, sizeof(buf)))) > 0 )
+                    sData.append(buf, n);
+                break;
+            }
+            case CB_WRITE_OK:
+                ++nWrite;
+                break;
+            case CB_CLOSED:
+                ++nClosed;
+                return CB_DROP_STREAM;
+            default:
+                break;
+            }
+            return CB_NONE;
+        }
+    };
+
+    /// Takes a single line per callback, leaving the rest buffered.
+    class line_callback : public cxx_utils::io::streambuf_callback
+    {
+    public:
+        std::string sLines;
+
+        virtual streambuf_cb_result callback(streambuf_cb_status eStatus,
+                                             std::streambuf *pStreamBuf)
+        {
+            if( eStatus != CB_READ_OK ) return CB_NONE;
+            for( int c; (c = pStreamBuf->sbumpc()) !=
+                     std::streambuf::traits_type::eof(); )
+            {
+                sLines += char(c);
+                if( c == '\n' ) break;
+            }
+            return CB_NONE;
+        }
+    };
+
+    void expect(bool bOk, const char *pWhat)
+    {
+        if( bOk ) return;
+        std::cout << "streambuf_monitor: " << pWhat << " FAILED" << std::endl;
+        std::exit(1);
+    }
+}
+
+template <class monitor>
+void check_monitor(typename monitor::trigger_mode eMode, const char *pName)
+{
+    int fds[2];
+    expect(0 == pipe(fds), "pipe");
+
+    monitor mon(eMode);
+    cxx_utils::io::fd_buffer reader(fds[0]);
+    cxx_utils::io::fd_buffer writer(fds[1], false);
+    recording_callback rcb, wcb;
+    expect(mon.push(&reader, rcb, false), "push reader");
+    expect(mon.push(&writer, wcb, false, true), "push writer");
+
+    expect(mon() == 1 && wcb.nWrite == 1 && rcb.nRead == 0,
+           "only the writable end is ready");
+    expect(mon.want_write(&writer, false), "want_write");
+
+    std::ostream out(&writer);
+    out << "ping" << std::flush;
+    expect(mon() == 1 && rcb.sData == "ping", "read after write");
+    expect(mon() == 0, "nothing new is ready");
+
+    close(fds[1]);
+    mon();
+    expect(rcb.nClosed == 1 && mon.size() == 1, "close drops the reader");
+
+    std::stringbuf polled("not a descriptor");
+    recording_callback pcb;
+    expect(mon.push(&polled, pcb, false), "push stringbuf");
+    mon();
+    expect(pcb.nRead == 1 && pcb.sData == "not a descriptor",
+           "stringbuf is polled");
+
+    std::cout << "streambuf_monitor (" << pName << "): ok" << std::endl;
+}
+
+/// Lines one callback left in the get area still come, one tick each.
+template <class monitor>
+void check_buffered_input(typename monitor::trigger_mode eMode)
+{
+    int fds[2];
+    expect(0 == pipe(fds), "pipe");
+    monitor mon(eMode);
+    cxx_utils::io::fd_buffer reader(fds[0]);
+    line_callback lcb;
+    expect(mon.push(&reader, lcb, false), "push reader");
+    expect(write(fds[1], "one\ntwo\nthree\n", 14) == 14, "write lines");
+
+    expect(mon(100) == 1 && lcb.sLines == "one\n", "first line");
+    expect(mon(1000) == 1 && lcb.sLines == "one\ntwo\n",
+           "buffered line without new data");
+    expect(mon(1000) == 1 && lcb.sLines == "one\ntwo\nthree\n",
+           "last buffered line");
+    expect(mon() == 0, "buffer drained");
+    close(fds[1]);
+}
+
+/// Popping a stream closed while monitored leaves its reused number alone.
+void check_reused_descriptor()
+{
+    typedef cxx_utils::io::fd_buffer fd_buffer;
+    int old[2], fresh[2];
+    expect(0 == pipe(old), "pipe");
+    cxx_utils::io::streambuf_monitor<> mon;
+    fd_buffer stale(old[0]);
+    recording_callback scb, rcb;
+    expect(mon.push(&stale, scb, false), "push stale");
+    const int number = stale.descriptor();
+    stale.close();
+    close(old[1]);
+
+    expect(0 == pipe(fresh) && fresh[0] == number, "descriptor reused");
+    fd_buffer reader(fresh[0]);
+    expect(mon.push(&reader, rcb, false), "push reader");
+    expect(mon.pop(&stale) && !mon.want_write(&stale, true), "pop stale");
+
+    expect(write(fresh[1], "still here", 10) == 10, "write");
+    expect(mon(100) == 1 && rcb.sData == "still here",
+           "reused descriptor still watched");
+    close(fresh[1]);
+}
+
+/// A megabyte through a socket pair, both ends non-blocking, one thread.
+void check_nonblocking()
+{
+    typedef cxx_utils::io::fd_buffer fd_buffer;
+    int sv[2];
+    expect(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair");
+
+    fd_buffer reader(sv[0]);
+    recording_callback rcb, wcb;
+    cxx_utils::io::streambuf_monitor<> mon;
+    {
+        fd_buffer writer(sv[1], std::size_t(4096));
+        expect(writer.set_nonblocking(true) && reader.set_nonblocking(true),
+               "set_nonblocking");
+
+        std::istream in(&reader);
+        char c;
+        expect(!in.get(c) &&
+               reader.read_state() == fd_buffer::io_would_block,
+               "empty read would block, not eof");
+        in.clear();
+
+        // far more than the socket holds: the rest waits in the buffer
+        const std::string block(1 << 20, 'n');
+        std::ostream out(&writer);
+        out << block << std::flush;
+        expect(out.good() && writer.pending_output() > 0 &&
+               writer.pending_output() < block.size(), "write backlog");
+
+        expect(mon.push(&reader, rcb, false) && mon.push(&writer, wcb, false),
+               "push");
+        for (int tick = 0; tick < 1000 && rcb.sData.size() < block.size();
+             ++tick)
+            mon(100);
+        expect(rcb.sData == block && writer.pending_output() == 0 &&
+               wcb.nWrite == 0, "monitor drains the backlog");
+        mon.pop(&writer);
+    }
+
+    // the writer's destructor closed its end
+    mon(100);
+    expect(rcb.nClosed == 1 && reader.read_state() != fd_buffer::io_error,
+           "eof after close");
+    std::cout << "fd_buffer non-blocking: ok" << std::endl;
+}
+
+/// A stalled peer can't hang the destructor; close() and abort() choose.
+void check_nonblocking_shutdown()
+{
+    typedef cxx_utils::io::fd_buffer fd_buffer;
+    const std::string block(1 << 20, 's');
+    int sv[2];
+
+    // nobody reads: the destructor keeps what fits and drops the rest
+    expect(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair");
+    {
+        fd_buffer writer(sv[1], std::size_t(4096));
+        expect(writer.set_nonblocking(true), "set_nonblocking");
+        std::ostream out(&writer);
+        out << block << std::flush;
+        expect(writer.pending_output() > 0, "stalled backlog");
+    }
+    std::string got;
+    char buf[65536];
+    ssize_t n;
+    while( (n = read(sv[0], buf, sizeof(buf))) > 0 )
+        got.append(buf, n);
+    expect(got.size() < block.size() && n == 0, "destructor drops the backlog");
+    close(sv[0]);
+
+    // close() waits for a slow reader instead
+    expect(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair");
+    got.clear();
+    std::thread reader([&]() {
+            usleep(20000);
+            ssize_t r;
+            while( (r = read(sv[0], buf, sizeof(buf))) > 0 )
+                got.append(buf, r);
+        });
+    {
+        fd_buffer writer(sv[1], std::size_t(4096));
+        expect(writer.set_nonblocking(true), "set_nonblocking");
+        std::ostream out(&writer);
+        out << block << std::flush;
+        expect(writer.close() == 0 && writer.descriptor() == -1 &&
+               writer.pending_output() == 0, "close() waits");
+    }
+    reader.join();
+    expect(got == block, "close() delivers everything");
+    close(sv[0]);
+
+    expect(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair");
+    {
+        fd_buffer writer(sv[1], std::size_t(4096));
+        std::ostream out(&writer);
+        out << "never sent";
+        writer.abort();
+        expect(writer.descriptor() == -1 && writer.pending_output() == 0,
+               "abort()");
+    }
+    expect(read(sv[0], buf, sizeof(buf)) == 0, "abort() drops output");
+    close(sv[0]);
+    std::cout << "fd_buffer shutdown: ok" << std::endl;
+}
+
+namespace cxx_utils_examples
+{
+    class RunTheMonitorExamples
+    {
+        typedef cxx_utils::io::streambuf_monitor<> monitor;
+    public:
+        RunTheMonitorExamples()
+        {
+            check_monitor<monitor>(monitor::level_triggered, "level");
+            check_monitor<monitor>(monitor::edge_triggered, "edge");
+            check_buffered_input<monitor>(monitor::level_triggered);
+            check_buffered_input<monitor>(monitor::edge_triggered);
+            check_reused_descriptor();
+            check_nonblocking();
+            check_nonblocking_shutdown();
+        }
+        ~RunTheMonitorExamples(){}
+    };
+
+    static RunTheMonitorExamples s_rtme;
+}
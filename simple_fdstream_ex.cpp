@@ -1,6 +1,11 @@
 #include "fd_buffer.hpp"
 
 #include <iostream>
+#include <cstdlib>
+#include <string>
+
+#include <sys/ioctl.h>
+#include <unistd.h>
 
 void check_outstream()
 {
@@ -32,12 +37,145 @@ void check_iostreams()
     out << std::endl;
 }
 
+static int pending_bytes(int fd)
+{
+    int n = 0;
+    ioctl(fd, FIONREAD, &n);
+    return n;
+}
+
+void check_buffered_output()
+{
+    int fds[2];
+    if( pipe(fds) ) return;
+    cxx_utils::io::fd_buffer reader(fds[0]);
+    bool ok;
+    {
+        cxx_utils::io::fd_buffer output(fds[1], std::size_t(64));
+        std::ostream out( &output );
+
+        out << "abc";
+        ok = pending_bytes(fds[0]) == 0;      // still in the put area
+        out << std::flush;
+        ok = ok && pending_bytes(fds[0]) == 3;
+
+        out << "de";
+        out << std::string(1000, 'x');       // pending + this: one writev
+        ok = ok && pending_bytes(fds[0]) == 1005;
+        out << "tail";                       // flushed by the destructor
+    }
+
+    std::istream in( &reader );
+    std::string all;
+    std::getline(in, all);
+    ok = ok && all == "abcde" + std::string(1000, 'x') + "tail";
+    if( !ok )
+    {
+        std::cout << "fd_buffer write buffering FAILED" << std::endl;
+        std::exit(1);
+    }
+}
+
+void check_bulk_reads()
+{
+    char path[] = "/tmp/cxxutils_bulkXXXXXX";
+    int fd = mkstemp(path);
+    if( fd == -1 ) return;
+    unlink(path);
+
+    std::string data(300000, '\0');
+    for( std::size_t i = 0; i < data.size(); ++i )
+        data[i] = char('a' + i % 23);
+    if( write(fd, data.data(), data.size()) != ssize_t(data.size()) ) return;
+    lseek(fd, 0, SEEK_SET);
+
+    cxx_utils::io::fd_buffer input(fd, std::size_t(1024));
+    std::istream in( &input );
+
+    // small gets first: the file keeps filling the buffer, so it grows
+    std::string got(100, '\0');
+    in.read(&got[0], 100);
+    for( int i = 0; i < 40000; ++i )
+        got += char(in.get());
+    bool ok = input.read_buffer_size() > 1024;
+
+    // then one large read, which bypasses the buffer
+    std::string rest(data.size() - got.size(), '\0');
+    in.read(&rest[0], rest.size());
+    ok = ok && in.gcount() == std::streamsize(rest.size());
+    in.unget();
+    ok = ok && in.get() == data[data.size() - 1];
+    if( !ok || got + rest != data )
+    {
+        std::cout << "fd_buffer bulk reads FAILED" << std::endl;
+        std::exit(1);
+    }
+}
+
+static int temp_file()
+{
+    char path[] = "/tmp/cxxutils_transferXXXXXX";
+    int fd = mkstemp(path);
+    if( fd != -1 ) unlink(path);
+    return fd;
+}
+
+void check_transfer()
+{
+    std::string data;
+    for( int i = 0; i < 20000; ++i )
+        data += "0123456789"[i % 10];
+
+    int src = temp_file(), dst = temp_file(), fds[2];
+    if( src == -1 || dst == -1 || pipe(fds) ) return;
+    if( write(src, data.data(), data.size()) != ssize_t(data.size()) ) return;
+    lseek(src, 0, SEEK_SET);
+
+    bool ok;
+    {
+        // file -> file with some of the input already buffered
+        cxx_utils::io::fd_buffer in(src), out(dst, false);
+        std::istream is( &in );
+        std::ostream os( &out );
+        char head[10];
+        is.read(head, sizeof(head));
+        os << "copy:";
+        ok = cxx_utils::io::transfer(in, out) == data.size() - 10;
+    }
+
+    std::string got(data.size() + 5 - 10, '\0');
+    lseek(dst, 0, SEEK_SET);
+    ok = ok && read(dst, &got[0], got.size()) == ssize_t(got.size()) &&
+        got == "copy:" + data.substr(10);
+
+    {
+        // pipe -> file, bounded
+        cxx_utils::io::fd_buffer in(fds[0]), out(dst, false);
+        ok = ok && write(fds[1], "spliced", 7) == 7;
+        close(fds[1]);
+        ok = ok && cxx_utils::io::transfer(in, out, 4) == 4;
+    }
+    std::string tail(4, '\0');
+    ok = ok && pread(dst, &tail[0], 4, got.size()) == 4 && tail == "spli";
+    close(dst);
+
+    if( !ok )
+    {
+        std::cout << "fd_buffer transfer FAILED" << std::endl;
+        std::exit(1);
+    }
+}
+
 namespace cxx_utils_examples
 {
     class RunTheIOStreamExamples
     {
     public:
-        RunTheIOStreamExamples(){ check_outstream(); check_iostreams(); }
+        RunTheIOStreamExamples()
+        {
+            check_outstream(); check_iostreams();
+            check_buffered_output(); check_bulk_reads(); check_transfer();
+        }
         ~RunTheIOStreamExamples(){}
     };
     
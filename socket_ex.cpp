@@ -0,0 +1,259 @@
+#include "socket_streambuf.hpp"
+#include "streambuf_monitor.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using cxx_utils::io::socket_streambuf;
+using cxx_utils::io::socket_options;
+
+namespace
+{
+    void expect(bool bOk, const char *pWhat)
+    {
+        if( bOk ) return;
+        std::cout << "socket_streambuf: " << pWhat << " FAILED" << std::endl;
+        std::exit(1);
+    }
+
+    /// Binds a loopback listener on an ephemeral port; -1 if @nFamily is absent.
+    int listen_loopback(int nFamily, int nType, int &rPort)
+    {
+        int s = socket(nFamily, nType, 0);
+        if( s == -1 ) return -1;
+        sockaddr_storage addr;
+        std::memset(&addr, 0, sizeof(addr));
+        socklen_t len;
+        if( nFamily == AF_INET6 )
+        {
+            sockaddr_in6 *p = (sockaddr_in6 *)&addr;
+            p->sin6_family = AF_INET6;
+            p->sin6_addr = in6addr_loopback;
+            len = sizeof(*p);
+        }
+        else
+        {
+            sockaddr_in *p = (sockaddr_in *)&addr;
+            p->sin_family = AF_INET;
+            p->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            len = sizeof(*p);
+        }
+        if( bind(s, (sockaddr *)&addr, len) ||
+            (nType == SOCK_STREAM && listen(s, 4)) ||
+            getsockname(s, (sockaddr *)&addr, &len) )
+        {
+            close(s);
+            return -1;
+        }
+        rPort = ntohs(nFamily == AF_INET6 ? ((sockaddr_in6 *)&addr)->sin6_port
+                      : ((sockaddr_in *)&addr)->sin_port);
+        return s;
+    }
+
+    /// Accepts one client and echoes it until it hangs up; one datagram for UDP.
+    void echo(int nListener, bool bStream)
+    {
+        char buf[4096];
+        if( !bStream )
+        {
+            sockaddr_storage peer;
+            socklen_t len = sizeof(peer);
+            ssize_t n = recvfrom(nListener, buf, sizeof(buf), 0,
+                                 (sockaddr *)&peer, &len);
+            if( n > 0 )
+                sendto(nListener, buf, n, 0, (sockaddr *)&peer, len);
+            return;
+        }
+        int c = accept(nListener, 0, 0);
+        if( c == -1 ) return;
+        ssize_t n;
+        while( (n = read(c, buf, sizeof(buf))) > 0 )
+            if( write(c, buf, n) != n ) break;
+        close(c);
+    }
+
+    class echo_reader : public cxx_utils::io::streambuf_callback
+    {
+    public:
+        std::string sData;
+        virtual streambuf_cb_result callback(streambuf_cb_status eStatus,
+                                             std::streambuf *pStreamBuf)
+        {
+            char buf[256];
+            std::streamsize n;
+            if( eStatus == CB_READ_OK )
+                while( (n = pStreamBuf->in_avail()) > 0 &&
+                       (n = pStreamBuf->sgetn(buf, std::min<std::streamsize>
+                                              (n, sizeof(buf)))) > 0 )
+                    sData.append(buf, n);
+            return CB_NONE;
+        }
+    };
+}
+
+/// Lines out, the same lines back, through an echo server at @rHost.
+void check_echo(const std::string &rHost, int nListener, bool bStream,
+                const socket_options &rOpts)
+{
+    std::thread server(echo, nListener, bStream);
+    {
+        socket_streambuf sock(rHost, rOpts);
+        expect(sock.is_open(), ("connect " + rHost).c_str());
+        expect(sock.is_stream() == bStream, "is_stream");
+        std::iostream io(&sock);
+        std::string line;
+        if( bStream )
+        {
+            sock.set_cork(true);
+            io << "first" << std::flush;
+            io << " line\n" << std::flush;
+            sock.set_cork(false);
+            sock.set_more(true);
+            io << "second " << std::flush;
+            sock.set_more(false);
+            io << "line\n" << std::flush;
+            expect(std::getline(io, line) && line == "first line",
+                   "echo (corked)");
+            expect(std::getline(io, line) && line == "second line",
+                   "echo (MSG_MORE)");
+        }
+        else
+        {
+            io << "one datagram\n" << std::flush;
+            expect(std::getline(io, line) && line == "one datagram",
+                   "datagram echo");
+        }
+        expect(io.good(), "stream state");
+    }
+    server.join();
+    close(nListener);
+}
+
+/// Connects without waiting; output queues until the monitor sees writable.
+void check_nonblocking_connect(int nListener, int nPort)
+{
+    std::thread server(echo, nListener, true);
+    {
+        std::ostringstream host;
+        // not "localhost": a late failure on ::1 would not fall back to v4
+        host << "tcp://127.0.0.1:" << nPort;
+        socket_options opts;
+        opts.bNonBlockingConnect = true;
+        socket_streambuf sock(host.str(), opts);
+        expect(sock.is_open() && sock.nonblocking(), "non-blocking connect");
+
+        std::ostream out(&sock);
+        out << "queued before connect\n" << std::flush;
+        expect(out.good(), "write while connecting");
+
+        echo_reader rcb;
+        cxx_utils::io::streambuf_monitor<> mon;
+        expect(mon.push(&sock, rcb, false), "push");
+        for (int tick = 0; tick < 100 &&
+                 rcb.sData != "queued before connect\n"; ++tick)
+            mon(100);
+        expect(rcb.sData == "queued before connect\n" &&
+               !sock.connecting() && sock.connect_error() == 0 &&
+               sock.pending_output() == 0, "monitor completes the connect");
+        mon.pop(&sock);
+    }
+    server.join();
+    close(nListener);
+}
+
+/// Output left for a peer that hung up is dropped, not a SIGPIPE.
+void check_closed_peer()
+{
+    int sv[2];
+    expect(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair");
+    close(sv[1]);
+    {
+        socket_streambuf sock(sv[0]);
+        std::ostream out(&sock);
+        out << "hello";
+        expect(sock.pending_output() == 5, "buffered for a closed peer");
+    }
+    // still running: the destructor sent with MSG_NOSIGNAL
+}
+
+void check_socket_streambuf()
+{
+    int port;
+    socket_options opts;
+    opts.bNoDelay = true;
+    opts.bQuickAck = true;
+    opts.nRecvBuf = opts.nSendBuf = 1 << 16;
+
+    int s = listen_loopback(AF_INET, SOCK_STREAM, port);
+    expect(s != -1, "tcp listener");
+    std::ostringstream v4;
+    v4 << "127.0.0.1:" << port;
+    check_echo(v4.str(), s, true, opts);
+
+    s = listen_loopback(AF_INET6, SOCK_STREAM, port);
+    if( s != -1 )
+    {
+        std::ostringstream v6;
+        v6 << "tcp://[::1]:" << port;
+        check_echo(v6.str(), s, true, opts);
+    }
+
+    s = listen_loopback(AF_INET, SOCK_DGRAM, port);
+    expect(s != -1, "udp socket");
+    std::ostringstream udp;
+    udp << "udp://127.0.0.1:" << port;
+    check_echo(udp.str(), s, false, socket_options());
+
+    char dir[] = "/tmp/cxxutils_sockXXXXXX";
+    expect(mkdtemp(dir) != 0, "mkdtemp");
+    const std::string path = std::string(dir) + "/echo";
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un sun;
+    std::memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    std::strcpy(sun.sun_path, path.c_str());
+    expect(s != -1 && !bind(s, (sockaddr *)&sun, sizeof(sun)) &&
+           !listen(s, 4), "unix listener");
+    check_echo("unix:" + path, s, true, socket_options());
+    unlink(path.c_str());
+    rmdir(dir);
+
+    s = listen_loopback(AF_INET, SOCK_STREAM, port);
+    expect(s != -1, "tcp listener");
+    check_nonblocking_connect(s, port);
+    check_closed_peer();
+
+    // a closed port and a malformed host both leave the buffer unopened
+    s = listen_loopback(AF_INET, SOCK_STREAM, port);
+    close(s);
+    std::ostringstream refused;
+    refused << "127.0.0.1:" << port;
+    expect(!socket_streambuf(refused.str()).is_open(), "refused");
+    expect(!socket_streambuf("no-port-here").is_open(), "malformed host");
+    socket_streambuf unknown("127.0.0.1:no-such-service");
+    expect(!unknown.is_open() && unknown.resolve_error() != 0,
+           "resolver error kept");
+    expect(socket_streambuf(v4.str()).resolve_error() == 0, "resolved");
+
+    std::cout << "socket_streambuf: ok" << std::endl;
+}
+
+namespace cxx_utils_examples
+{
+    class RunTheSocketExamples
+    {
+    public:
+        RunTheSocketExamples(){ check_socket_streambuf(); }
+        ~RunTheSocketExamples(){}
+    };
+
+    static RunTheSocketExamples s_rtse;
+}
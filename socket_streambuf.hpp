@@ -9,8 +9,8 @@
 // - ???
 // - profit
 
-/** @file fd_buffer.hpp
- * File-descriptor streambuf object
+/** @file socket_streambuf.hpp
+ * Socket streambuf object
  */
 
 #pragma once
@@ -18,8 +18,18 @@
 #ifdef WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #endif
 
+#include <string>
+#include <cstring>
+#include <cerrno>
+
 #include "fd_buffer.hpp"
 
 #ifndef __SOCKET_DESCRIPTOR_BUFFER__H__
@@ -29,21 +39,162 @@ namespace cxx_utils
 {
     namespace io
     {
+        /**
+         * Connection-time choices for a socket_streambuf. The buffer sizes
+         * are left to the kernel when 0.
+         */
+        struct socket_options
+        {
+            bool bNonBlockingConnect; ///< return at once; see connecting()
+            bool bNoDelay;            ///< TCP_NODELAY
+            bool bQuickAck;           ///< TCP_QUICKACK
+            bool bReusePort;          ///< SO_REUSEPORT
+            int  nRecvBuf;            ///< SO_RCVBUF
+            int  nSendBuf;            ///< SO_SNDBUF
+
+            socket_options() : bNonBlockingConnect(false), bNoDelay(false),
+                               bQuickAck(false), bReusePort(false),
+                               nRecvBuf(0), nSendBuf(0) {}
+        };
+
         /**
          * \brief An iostream style streambuf operating on socket file descriptors
          * sockstreambuf takes either a string-style host:port and constructs a socket, or can optionally take an fd/SOCKET object which is an already allocated socket.
+         *
+         * Host strings are "host:port" or "[v6-address]:port" for TCP,
+         * optionally prefixed with "tcp://" or "udp://", and "unix:/path"
+         * (or "unix:///path") for a Unix domain stream socket. Names are
+         * resolved with getaddrinfo() and each address is tried in turn.
+         * A non-blocking connect moves on only past addresses that fail at
+         * once; the first one left in progress is kept, and if it fails
+         * later (connect_error()) the others aren't tried, so "localhost"
+         * may end up on ::1 when only 127.0.0.1 listens. Give the address
+         * itself where that matters. The buffer is then in non-blocking
+         * mode (see fd_buffer), so output written before the connection
+         * completes is queued. A streambuf_monitor flushes it once the
+         * socket becomes writable.
+         *
+         * On a UDP socket each flush of the put area is sent as one
+         * datagram.
          */
         class socket_streambuf : public fd_buffer
         {
         public:
-            socket_streambuf(const std::string &rHost) : fd_buffer(GetSocketFromHost(rHost)), m_bStreamSock(GetSocketStreamFlag(rHost, m_nFileDes)), m_sHostUri(rHost)
+            explicit socket_streambuf(const std::string &rHost,
+                                      const socket_options &rOpts =
+                                      socket_options())
+                : fd_buffer(-1), m_bStreamSock(false), m_sHostUri(rHost),
+                  m_bMore(false), m_nResolveError(0)
+            {
+                m_nFileDes = GetSocketFromHost(rHost, rOpts, m_nResolveError);
+                m_bStreamSock = GetSocketStreamFlag(rHost, m_nFileDes);
+                if( m_nFileDes != -1 && rOpts.bNonBlockingConnect )
+                    set_nonblocking(true);
+            }
+
+            /// Wraps an already connected (or connecting) socket.
+            explicit socket_streambuf(int nSocket, bool bOwner = true)
+                : fd_buffer(nSocket, bOwner),
+                  m_bStreamSock(GetSocketStreamFlag(std::string(), nSocket)),
+                  m_sHostUri(), m_bMore(false), m_nResolveError(0)
+            {
+            }
+
+            /**
+             * Flushes as ~fd_buffer would, but through send() here: by the
+             * time the base destructor runs, its writes no longer reach the
+             * MSG_NOSIGNAL overrides, and a closed peer would raise SIGPIPE.
+             * Whatever can't be sent is dropped.
+             */
+            virtual ~socket_streambuf()
+            {
+                flush_output();
+                setp(pbase(), epptr());
+            }
+
+            /**
+             * False when the host couldn't be resolved or connected; see
+             * resolve_error(), then errno.
+             */
+            bool is_open() const { return m_nFileDes != -1; }
+
+            /**
+             * The getaddrinfo() code (EAI_*, for gai_strerror()) when the
+             * host couldn't be resolved, or 0. errno means something only
+             * alongside EAI_SYSTEM.
+             */
+            int resolve_error() const { return m_nResolveError; }
+
+            /// True while a non-blocking connect is still under way.
+            bool connecting() const
+            {
+                if( m_nFileDes == -1 ) return false;
+                sockaddr_storage peer;
+                socklen_t len = sizeof(peer);
+                return getpeername(m_nFileDes, (sockaddr *)&peer, &len) < 0 &&
+                    errno == ENOTCONN && connect_error() == 0;
+            }
+
+            /// The pending error of a failed (non-blocking) connect, or 0.
+            int connect_error() const
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if( getsockopt(m_nFileDes, SOL_SOCKET, SO_ERROR, &err, &len) )
+                    return errno;
+                return err;
+            }
+
+            bool is_stream() const { return m_bStreamSock; }
+            const std::string &host() const { return m_sHostUri; }
+
+            /// Disables Nagle, for latency-sensitive request/response traffic.
+            bool set_nodelay(bool bOn)
             {
-                
+                return set_int(IPPROTO_TCP, TCP_NODELAY, bOn);
+            }
+
+            /**
+             * Holds back partial segments until uncorked, so a header and
+             * body written separately leave as full segments.
+             */
+            bool set_cork(bool bOn)
+            {
+#ifdef TCP_CORK
+                return set_int(IPPROTO_TCP, TCP_CORK, bOn);
+#else
+                (void)bOn;
+                return false;
+#endif
+            }
+
+            /**
+             * Marks every write with MSG_MORE until turned off: a per-write
+             * cork that needs no setsockopt() to release.
+             */
+            void set_more(bool bOn) { m_bMore = bOn; }
+
+            /// Acknowledges at once instead of delaying; the kernel may reset it.
+            bool set_quickack(bool bOn)
+            {
+#ifdef TCP_QUICKACK
+                return set_int(IPPROTO_TCP, TCP_QUICKACK, bOn);
+#else
+                (void)bOn;
+                return false;
+#endif
+            }
+
+            /// Kernel socket buffer sizes; 0 leaves one unchanged.
+            bool set_buffer_sizes(int nRecv, int nSend)
+            {
+                return (!nRecv || set_int(SOL_SOCKET, SO_RCVBUF, nRecv)) &&
+                    (!nSend || set_int(SOL_SOCKET, SO_SNDBUF, nSend));
             }
 
         protected:
-            
-            
+
+
             virtual std::streamsize internal_rd_ioctl()
             {
                 int numBytes = 0;
@@ -54,9 +205,196 @@ namespace cxx_utils
                 return numBytes;
             }
 
+            virtual ssize_t internal_write(void *buf, size_t len)
+            {
+                return send(m_nFileDes, buf, len, send_flags());
+            }
+
+            virtual ssize_t internal_writev(const struct iovec *iov, int cnt)
+            {
+                msghdr msg;
+                std::memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = const_cast<struct iovec *>(iov);
+                msg.msg_iovlen = cnt;
+                return sendmsg(m_nFileDes, &msg, send_flags());
+            }
+
         private:
+            bool set_int(int nLevel, int nName, int nValue)
+            {
+                return 0 == setsockopt(m_nFileDes, nLevel, nName, &nValue,
+                                       sizeof(nValue));
+            }
+
+            int send_flags() const
+            {
+                int flags = 0;
+#ifdef MSG_NOSIGNAL
+                flags |= MSG_NOSIGNAL;   // EPIPE instead of SIGPIPE
+#endif
+#ifdef MSG_MORE
+                if( m_bMore ) flags |= MSG_MORE;
+#endif
+                return flags;
+            }
+
+            static void ApplySocketOptions(int nSocket, int nFamily,
+                                           int nType,
+                                           const socket_options &rOpts)
+            {
+                int on = 1;
+                if( rOpts.nRecvBuf )
+                    setsockopt(nSocket, SOL_SOCKET, SO_RCVBUF,
+                               &rOpts.nRecvBuf, sizeof(rOpts.nRecvBuf));
+                if( rOpts.nSendBuf )
+                    setsockopt(nSocket, SOL_SOCKET, SO_SNDBUF,
+                               &rOpts.nSendBuf, sizeof(rOpts.nSendBuf));
+#ifdef SO_REUSEPORT
+                if( rOpts.bReusePort )
+                    setsockopt(nSocket, SOL_SOCKET, SO_REUSEPORT, &on,
+                               sizeof(on));
+#endif
+                if( nFamily == AF_UNIX || nType != SOCK_STREAM ) return;
+                if( rOpts.bNoDelay )
+                    setsockopt(nSocket, IPPROTO_TCP, TCP_NODELAY, &on,
+                               sizeof(on));
+#ifdef TCP_QUICKACK
+                if( rOpts.bQuickAck )
+                    setsockopt(nSocket, IPPROTO_TCP, TCP_QUICKACK, &on,
+                               sizeof(on));
+#endif
+            }
+
+            /// Waits out a connect already under way on @nSocket; -1 if it failed.
+            static int FinishConnect(int nSocket)
+            {
+                pollfd pfd;
+                pfd.fd = nSocket;
+                pfd.events = POLLOUT;
+                int ret;
+                do
+                {
+                    ret = poll(&pfd, 1, -1);
+                } while( ret < 0 && errno == EINTR );
+                if( ret < 0 ) return -1;
+
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if( getsockopt(nSocket, SOL_SOCKET, SO_ERROR, &err, &len) )
+                    return -1;
+                if( !err ) return 0;
+                errno = err;
+                return -1;
+            }
+
+            /// Creates, tunes and connects one socket; -1 on failure.
+            static int ConnectSocket(int nFamily, int nType, int nProtocol,
+                                     const sockaddr *pAddr, socklen_t nLen,
+                                     const socket_options &rOpts)
+            {
+                int flags = SOCK_CLOEXEC;
+                if( rOpts.bNonBlockingConnect ) flags |= SOCK_NONBLOCK;
+                int s = socket(nFamily, nType | flags, nProtocol);
+                if( s == -1 ) return -1;
+
+                ApplySocketOptions(s, nFamily, nType, rOpts);
+                int ret = connect(s, pAddr, nLen);
+                // an interrupted connect carries on in the background;
+                // calling connect() again would only say EALREADY
+                if( ret < 0 && errno == EINTR )
+                {
+                    if( rOpts.bNonBlockingConnect ) return s;
+                    ret = FinishConnect(s);
+                }
+                if( ret == 0 || (rOpts.bNonBlockingConnect &&
+                                 errno == EINPROGRESS) )
+                    return s;
+
+                const int err = errno;
+                ::close(s);
+                errno = err;
+                return -1;
+            }
+
+            /**
+             * Splits @rHost into scheme, node and service and returns a
+             * connected socket, or -1 with errno or @rResolveError set.
+             */
+            static int GetSocketFromHost(const std::string &rHost,
+                                         const socket_options &rOpts,
+                                         int &rResolveError)
+            {
+                std::string rest = rHost;
+                int type = SOCK_STREAM;
+                if( rest.compare(0, 6, "tcp://") == 0 )
+                    rest.erase(0, 6);
+                else if( rest.compare(0, 6, "udp://") == 0 )
+                {
+                    rest.erase(0, 6);
+                    type = SOCK_DGRAM;
+                }
+                else if( rest.compare(0, 5, "unix:") == 0 )
+                {
+                    rest.erase(0, rest.compare(0, 7, "unix://") ? 5 : 7);
+                    sockaddr_un addr;
+                    std::memset(&addr, 0, sizeof(addr));
+                    if( rest.empty() || rest.size() >= sizeof(addr.sun_path) )
+                    {
+                        errno = ENAMETOOLONG;
+                        return -1;
+                    }
+                    addr.sun_family = AF_UNIX;
+                    std::memcpy(addr.sun_path, rest.data(), rest.size());
+                    return ConnectSocket(AF_UNIX, SOCK_STREAM, 0,
+                                         (const sockaddr *)&addr,
+                                         sizeof(addr), rOpts);
+                }
+
+                std::string::size_type colon = rest.rfind(':');
+                if( colon == std::string::npos || colon + 1 == rest.size() )
+                {
+                    errno = EINVAL;
+                    return -1;
+                }
+                std::string node = rest.substr(0, colon);
+                const std::string service = rest.substr(colon + 1);
+                if( node.size() >= 2 && node[0] == '[' &&
+                    node[node.size() - 1] == ']' )
+                    node = node.substr(1, node.size() - 2);
+
+                addrinfo hints;
+                std::memset(&hints, 0, sizeof(hints));
+                hints.ai_family = AF_UNSPEC;
+                hints.ai_socktype = type;
+                hints.ai_flags = AI_ADDRCONFIG;
+                addrinfo *res = 0;
+                rResolveError = getaddrinfo(node.empty() ? 0 : node.c_str(),
+                                            service.c_str(), &hints, &res);
+                if( rResolveError != 0 )
+                    return -1;
+
+                int s = -1;
+                for(addrinfo *ai = res; ai && s == -1; ai = ai->ai_next)
+                    s = ConnectSocket(ai->ai_family, ai->ai_socktype,
+                                      ai->ai_protocol, ai->ai_addr,
+                                      ai->ai_addrlen, rOpts);
+                freeaddrinfo(res);
+                return s;
+            }
+
+            static bool GetSocketStreamFlag(const std::string &, int nSocket)
+            {
+                int type = 0;
+                socklen_t len = sizeof(type);
+                return nSocket != -1 &&
+                    0 == getsockopt(nSocket, SOL_SOCKET, SO_TYPE, &type, &len) &&
+                    type == SOCK_STREAM;
+            }
+
             bool m_bStreamSock;
             const std::string m_sHostUri;
+            bool m_bMore;
+            int m_nResolveError;
         };
     }
 }
@@ -1,8 +1,38 @@
+// "streambuf_monitor" -*- C++ -*-
+
+// Copyright (C) 2014 Aaron Conole
+//
+// This file is governed by the 'use this freely' common-sense license
+// This means the following:
+// - Take this header
+// - #include it in your project (commercial, or non)
+// - ???
+// - profit
+
+/** @file streambuf_monitor.hpp
+ * Event dispatch for a set of streambufs
+ */
+
+#pragma once
+
+#include <list>
 #include <map>
+#include <vector>
 #include <streambuf>
+#include <cerrno>
+#include <cstdint>
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define CXX_UTILS_HAVE_EPOLL 1
+#endif
+
+#include "fd_buffer.hpp"
 #include "interlocked_traits.hpp"
 
+#ifndef __STREAMBUF_MONITOR__H__
+#define __STREAMBUF_MONITOR__H__
+
 namespace cxx_utils
 {
     namespace io
@@ -33,7 +63,7 @@ namespace cxx_utils
                 CB_OPENED,
                 CB_CLOSED
             };
-            
+
             streambuf_callback(){}
             virtual ~streambuf_callback(){}
 
@@ -51,68 +81,375 @@ namespace cxx_utils
         /**
          * A streambuf_monitor is a way of wrapping up event based IO using the std::streambuf
          * interface, and wrapping a lightweight logic around it.
+         *
+         * Streambufs backed by a descriptor (fd_buffer and its subclasses)
+         * are registered with epoll, so a tick costs one epoll_wait() and
+         * only ready streams see a callback, however many are monitored.
+         * Anything else (or a descriptor epoll refuses, such as a regular
+         * file) is polled through in_avail() on every tick, as before.
+         *
+         * In edge_triggered mode a stream is reported once per arrival of
+         * new data; the callback must then read until the descriptor would
+         * block, or it won't hear about that stream again. Bytes a
+         * callback leaves in a fd_buffer's get area raise no event of their
+         * own, so in either mode the stream is called back with CB_READ_OK
+         * again on the next tick (which then doesn't block) until the
+         * stream has read them; telling how much is left costs no syscall.
+         *
+         * A non-blocking fd_buffer holding output its descriptor wouldn't
+         * take (fd_buffer::pending_output()) is watched for writability
+         * until that backlog is flushed, which the monitor does itself;
+         * CB_WRITE_OK is still only for streams that asked for it. The
+         * backlog is checked after every callback for the stream, and on
+         * update() for output written from elsewhere.
+         *
+         * Callbacks run with the monitor locked: return CB_DROP_STREAM
+         * rather than calling pop() from inside one, unless the lock trait
+         * is recursive.
          */
         template <class interlocked_trait = cxx_utils::null_interlocked_trait>
         class streambuf_monitor
         {
-            std::map<std::streambuf*,streambuf_callback&> m_cCallbacks;
+        public:
+            enum trigger_mode
+            {
+                level_triggered,
+                edge_triggered
+            };
+
+        private:
+            struct watch
+            {
+                streambuf_callback *pCB;
+                fd_buffer          *pFdBuffer;  ///< set when epoll watched
+                int                 nFileDes;   ///< -1 when polled
+                bool                bWantWrite;
+                bool                bBacklog;   ///< output awaiting EPOLLOUT
+                bool                bBuffered;  ///< queued in m_cBuffered
+                bool                bDropped;
+            };
+
+            typedef std::map<std::streambuf*, watch> watch_map;
+
+            watch_map                m_cWatches;
             std::list<std::streambuf*> m_cToDrop;
-            interlocked_trait :: locked_exchange_type m_eLock;
+            std::vector<std::streambuf*> m_cBuffered;  ///< input left in the get area
+            std::vector<std::streambuf*> m_cRecheck;
+            typename interlocked_trait::locked_exchange_type m_eLock;
+            trigger_mode             m_eMode;
+            int                      m_nEpoll;
+            std::size_t              m_nPolled;
+            bool                     m_bDispatching;
+#ifdef CXX_UTILS_HAVE_EPOLL
+            std::vector<epoll_event> m_cEvents;
+
+            std::uint32_t epoll_mask(const watch &w) const
+            {
+                std::uint32_t events = EPOLLIN | EPOLLRDHUP;
+                if( w.bWantWrite || w.bBacklog ) events |= EPOLLOUT;
+                if( m_eMode == edge_triggered ) events |= EPOLLET;
+                return events;
+            }
 
-            static void check_buffer
-            (std::map<std::streambuf*,streambuf_callback&>::value_type t, std::list<std::streambuf*> &rList)
+            /**
+             * Whether @w's descriptor is still the one push() registered; a
+             * stream close()d while monitored left epoll with it, and its
+             * number may now belong to a stream pushed since.
+             */
+            static bool registered(const watch &w)
             {
-                std::streambuf *pStream = t.first;
+                return w.nFileDes != -1 &&
+                    w.pFdBuffer->descriptor() == w.nFileDes;
+            }
+
+            bool epoll_update(int nOp, typename watch_map::value_type &rEntry)
+            {
+                if( nOp != EPOLL_CTL_ADD && !registered(rEntry.second) )
+                    return false;
+                epoll_event ev;
+                ev.events = epoll_mask(rEntry.second);
+                ev.data.ptr = &rEntry;
+                return 0 == epoll_ctl(m_nEpoll, nOp, rEntry.second.nFileDes,
+                                      &ev);
+            }
+
+            /// Follows the stream's unflushed output with EPOLLOUT interest.
+            bool update_backlog(typename watch_map::value_type &rEntry)
+            {
+                watch &w = rEntry.second;
+                if( !w.pFdBuffer || w.bDropped ) return true;
+                const bool bBacklog = w.pFdBuffer->pending_output() != 0;
+                if( bBacklog == w.bBacklog ) return true;
+                w.bBacklog = bBacklog;
+                return epoll_update(EPOLL_CTL_MOD, rEntry);
+            }
+
+            /// Queues the stream for the next tick if input is left unread.
+            void note_buffered(typename watch_map::value_type &rEntry)
+            {
+                watch &w = rEntry.second;
+                if( !w.pFdBuffer || w.bDropped || w.bBuffered ||
+                    !w.pFdBuffer->buffered_input() ) return;
+                w.bBuffered = true;
+                m_cBuffered.push_back(rEntry.first);
+            }
+
+            /**
+             * Calls back the streams queued by the previous tick that still
+             * hold input, unless this tick's events already queued them.
+             */
+            void dispatch_buffered(std::size_t &nCalls)
+            {
+                for(std::size_t i = 0; i < m_cRecheck.size(); ++i)
+                {
+                    typename watch_map::iterator iWatch =
+                        m_cWatches.find(m_cRecheck[i]);
+                    if( iWatch == m_cWatches.end() || iWatch->second.bDropped ||
+                        iWatch->second.bBuffered || !iWatch->second.pFdBuffer ||
+                        !iWatch->second.pFdBuffer->buffered_input() )
+                        continue;
+                    if( notify(*iWatch, streambuf_callback::CB_READ_OK,
+                               nCalls) == streambuf_callback::CB_DROP_STREAM )
+                    {
+                        drop(*iWatch);
+                        continue;
+                    }
+                    update_backlog(*iWatch);
+                    note_buffered(*iWatch);
+                }
+                m_cRecheck.clear();
+            }
+#endif
+
+            static streambuf_callback::streambuf_cb_result
+            notify(typename watch_map::value_type &rEntry,
+                   streambuf_callback::streambuf_cb_status eStatus,
+                   std::size_t &nCalls)
+            {
+                ++nCalls;
+                return rEntry.second.pCB->callback(eStatus, rEntry.first);
+            }
+
+            /// The original in_avail() check, for streambufs without a descriptor.
+            void check_buffer(typename watch_map::value_type &rEntry,
+                              std::size_t &nCalls)
+            {
+                std::streambuf *pStream = rEntry.first;
                 std::streamsize nBytes = pStream->in_avail();
                 streambuf_callback::streambuf_cb_result result =
                     streambuf_callback::CB_NONE;
                 if( nBytes == -1 )
                 {
-                    result = (t.second).callback
-                        (streambuf_callback::CB_CLOSED, pStream);
+                    result = notify(rEntry, streambuf_callback::CB_CLOSED,
+                                    nCalls);
                 } else if ( nBytes > 0 )
                 {
-                    result = (t.second).callback
-                        (streambuf_callback::CB_READ_OK, pStream);
+                    result = notify(rEntry, streambuf_callback::CB_READ_OK,
+                                    nCalls);
+                }
+
+                if( result != streambuf_callback::CB_DROP_STREAM &&
+                    nBytes != -1 && rEntry.second.bWantWrite )
+                {
+                    result = notify(rEntry, streambuf_callback::CB_WRITE_OK,
+                                    nCalls);
                 }
 
                 if( result == streambuf_callback::CB_DROP_STREAM )
+                    drop(rEntry);
+            }
+
+#ifdef CXX_UTILS_HAVE_EPOLL
+            /**
+             * Turns one epoll event into callbacks. A hangup is reported as
+             * CB_CLOSED only once the kernel has nothing left to read, so a
+             * peer's last bytes still arrive as CB_READ_OK first.
+             */
+            void dispatch(typename watch_map::value_type &rEntry,
+                          std::uint32_t nEvents, std::size_t &nCalls)
+            {
+                if( rEntry.second.bDropped ) return;
+
+                const bool bHangup =
+                    0 != (nEvents & (EPOLLHUP | EPOLLERR | EPOLLRDHUP));
+                bool bReadable = 0 != (nEvents & EPOLLIN);
+                if( bReadable && bHangup )
                 {
-                    rList.push_back(pStream);
+                    int nPending = 0;
+                    bReadable = 0 == ioctl(rEntry.second.nFileDes, FIONREAD,
+                                           &nPending) && nPending > 0;
                 }
 
+                streambuf_callback::streambuf_cb_result result =
+                    streambuf_callback::CB_NONE;
+                if( bReadable )
+                    result = notify(rEntry, streambuf_callback::CB_READ_OK,
+                                    nCalls);
+                else if( bHangup )
+                    result = notify(rEntry, streambuf_callback::CB_CLOSED,
+                                    nCalls);
+
+                if( result != streambuf_callback::CB_DROP_STREAM &&
+                    (nEvents & EPOLLOUT) && !(nEvents & (EPOLLHUP | EPOLLERR)) )
+                {
+                    if( rEntry.second.pFdBuffer->pending_output() )
+                        rEntry.second.pFdBuffer->pubsync();
+                    if( rEntry.second.bWantWrite )
+                        result = notify(rEntry,
+                                        streambuf_callback::CB_WRITE_OK,
+                                        nCalls);
+                }
+
+                if( result == streambuf_callback::CB_DROP_STREAM )
+                {
+                    drop(rEntry);
+                    return;
+                }
+                update_backlog(rEntry);
+                note_buffered(rEntry);
             }
+#endif
 
-            struct buffer_checker
+            void drop(typename watch_map::value_type &rEntry)
             {
-                streambuf_monitor *pMon;
-                void operator()(std::map<std::streambuf*,streambuf_callback&>::value_type t)
+                if( rEntry.second.bDropped ) return;
+                rEntry.second.bDropped = true;
+                m_cToDrop.push_back(rEntry.first);
+            }
+
+            void forget(typename watch_map::iterator iWatch)
+            {
+#ifdef CXX_UTILS_HAVE_EPOLL
+                if( iWatch->second.nFileDes != -1 )
                 {
-                    streambuf_monitor::check_buffer(t, pMon->m_cToDrop);
+                    if( registered(iWatch->second) )
+                        epoll_ctl(m_nEpoll, EPOLL_CTL_DEL,
+                                  iWatch->second.nFileDes, NULL);
                 }
-            };
-            
+                else
+#endif
+                    --m_nPolled;
+                m_cWatches.erase(iWatch);
+            }
+
+            void flush_drops()
+            {
+                for(std::list<std::streambuf*>::iterator iDrop = m_cToDrop.begin();
+                    iDrop != m_cToDrop.end(); ++iDrop)
+                {
+                    typename watch_map::iterator iWatch =
+                        m_cWatches.find(*iDrop);
+                    if( iWatch != m_cWatches.end() ) forget(iWatch);
+                }
+
+                m_cToDrop.clear();
+            }
+
         public:
-            streambuf_monitor() {}
-            ~streambuf_monitor() {}
+            /**
+             * @param eMode How epoll reports readiness; ignored for polled streambufs.
+             * @param nMaxEvents The most ready streams handled in one tick.
+             */
+            explicit streambuf_monitor(trigger_mode eMode = level_triggered,
+                                       std::size_t nMaxEvents = 256)
+                : m_eMode(eMode), m_nEpoll(-1), m_nPolled(0),
+                  m_bDispatching(false)
+            {
+#ifdef CXX_UTILS_HAVE_EPOLL
+                m_nEpoll = epoll_create1(EPOLL_CLOEXEC);
+                m_cEvents.resize(nMaxEvents ? nMaxEvents : 1);
+#endif
+            }
+
+            ~streambuf_monitor()
+            {
+                if( m_nEpoll != -1 ) close(m_nEpoll);
+            }
 
             /**
              * Adds a streambuf to be monitored, with a specific callback instance.
              * Additionally, if bCallOpen is true, the streambuf callback will be told that the streambuf has been opened.
+             * With bWantWrite the callback also hears CB_WRITE_OK whenever the stream can take more output.
+             * Returns false if the streambuf is already monitored or the callback dropped it.
              */
             bool push(std::streambuf *pBuffer, streambuf_callback &rCB,
-                      bool bCallOpen)
+                      bool bCallOpen, bool bWantWrite = false)
             {
-                interlocked_trait::locked_exchange e(m_eLock);
+                typename interlocked_trait::locked_exchange e(m_eLock);
+                if( m_cWatches.count(pBuffer) ) return false;
                 if ( bCallOpen )
                 {
                     streambuf_callback::streambuf_cb_result result =
                         rCB.callback(streambuf_callback::CB_OPENED,
                                      pBuffer);
                     if( result == streambuf_callback::CB_DROP_STREAM )
-                        return;
+                        return false;
                 }
-                m_cCallbacks[pBuffer] = rCB;
+
+                watch w;
+                w.pCB = &rCB;
+                w.pFdBuffer = 0;
+                w.nFileDes = -1;
+                w.bWantWrite = bWantWrite;
+                w.bBacklog = false;
+                w.bBuffered = false;
+                w.bDropped = false;
+                typename watch_map::value_type &rEntry =
+                    *m_cWatches.insert(std::make_pair(pBuffer, w)).first;
+
+#ifdef CXX_UTILS_HAVE_EPOLL
+                fd_buffer *pFdBuffer = dynamic_cast<fd_buffer *>(pBuffer);
+                if( m_nEpoll != -1 && pFdBuffer &&
+                    pFdBuffer->descriptor() != -1 )
+                {
+                    rEntry.second.pFdBuffer = pFdBuffer;
+                    rEntry.second.nFileDes = pFdBuffer->descriptor();
+                    rEntry.second.bBacklog = pFdBuffer->pending_output() != 0;
+                    if( epoll_update(EPOLL_CTL_ADD, rEntry) )
+                    {
+                        note_buffered(rEntry);
+                        return true;
+                    }
+                    rEntry.second.pFdBuffer = 0;
+                    rEntry.second.nFileDes = -1;
+                    rEntry.second.bBacklog = false;
+                }
+#endif
+                ++m_nPolled;
+                return true;
+            }
+
+            /**
+             * Turns CB_WRITE_OK notifications for a monitored streambuf on or off.
+             */
+            bool want_write(std::streambuf *pBuffer, bool bWantWrite)
+            {
+                typename interlocked_trait::locked_exchange e(m_eLock);
+                typename watch_map::iterator iWatch = m_cWatches.find(pBuffer);
+                if( iWatch == m_cWatches.end() ) return false;
+                if( iWatch->second.bWantWrite == bWantWrite ) return true;
+                iWatch->second.bWantWrite = bWantWrite;
+#ifdef CXX_UTILS_HAVE_EPOLL
+                if( iWatch->second.nFileDes != -1 )
+                    return epoll_update(EPOLL_CTL_MOD, *iWatch);
+#endif
+                return true;
+            }
+
+            /**
+             * Re-checks a monitored stream's unflushed output, for writes
+             * made outside its callbacks.
+             */
+            bool update(std::streambuf *pBuffer)
+            {
+                typename interlocked_trait::locked_exchange e(m_eLock);
+                typename watch_map::iterator iWatch = m_cWatches.find(pBuffer);
+                if( iWatch == m_cWatches.end() ) return false;
+#ifdef CXX_UTILS_HAVE_EPOLL
+                return update_backlog(*iWatch);
+#else
+                return true;
+#endif
             }
 
             /**
@@ -120,26 +457,78 @@ namespace cxx_utils
              */
             bool pop(std::streambuf *pBuffer)
             {
-                interlocked_trait::locked_exchange e(m_eLock);
-                if(m_cCallbacks.erase(pBuffer) != m_cCallbacks.end()) return true;
-                return false;
+                typename interlocked_trait::locked_exchange e(m_eLock);
+                typename watch_map::iterator iWatch = m_cWatches.find(pBuffer);
+                if( iWatch == m_cWatches.end() || iWatch->second.bDropped )
+                    return false;
+                if( m_bDispatching )
+                    drop(*iWatch);  // an event for it may still be pending
+                else
+                    forget(iWatch);
+                return true;
             }
-            
-            void operator()
+
+            std::size_t size() const { return m_cWatches.size(); }
+
+            /**
+             * Runs one tick: waits up to nTimeoutMs (-1 blocks) for a monitored
+             * descriptor to become ready, then calls back for every ready stream.
+             * Returns the number of callbacks made.
+             */
+            std::size_t operator()(int nTimeoutMs = 0)
             {
-                interlocked_trait::locked_exchange e(m_eLock);
-                buffer_checker bc;
-                bc.pMon = this;
-                for_each( m_cCallbacks.begin(), m_cCallbacks.end(),
-                          bc );
-                for(std::list<std::streambuf*>::iterator iDrop = m_cToDrop.begin();
-                    iDrop != m_cToDrop.end(); ++iDrop)
+                typename interlocked_trait::locked_exchange e(m_eLock);
+                std::size_t nCalls = 0;
+                m_bDispatching = true;
+
+#ifdef CXX_UTILS_HAVE_EPOLL
+                if( m_nEpoll != -1 && m_cWatches.size() != m_nPolled )
                 {
-                    m_cCallbacks.erase(*iDrop);
+                    // streams still holding input are ready already
+                    m_cRecheck.swap(m_cBuffered);
+                    for(std::size_t i = 0; i < m_cRecheck.size(); ++i)
+                    {
+                        typename watch_map::iterator iWatch =
+                            m_cWatches.find(m_cRecheck[i]);
+                        if( iWatch != m_cWatches.end() )
+                            iWatch->second.bBuffered = false;
+                    }
+
+                    int nReady;
+                    do
+                    {
+                        nReady = epoll_wait(m_nEpoll, &m_cEvents.front(),
+                                            int(m_cEvents.size()),
+                                            m_nPolled || !m_cRecheck.empty() ?
+                                            0 : nTimeoutMs);
+                    } while( nReady < 0 && errno == EINTR );
+
+                    for(int i = 0; i < nReady; ++i)
+                    {
+                        dispatch(*static_cast<typename watch_map::value_type *>
+                                 (m_cEvents[i].data.ptr),
+                                 m_cEvents[i].events, nCalls);
+                    }
+                    dispatch_buffered(nCalls);
                 }
+#endif
 
-                m_cToDrop.clear();
+                if( m_nPolled )
+                {
+                    for(typename watch_map::iterator iWatch = m_cWatches.begin();
+                        iWatch != m_cWatches.end(); ++iWatch)
+                    {
+                        if( iWatch->second.nFileDes == -1 &&
+                            !iWatch->second.bDropped )
+                            check_buffer(*iWatch, nCalls);
+                    }
+                }
+
+                m_bDispatching = false;
+                flush_drops();
+                return nCalls;
             }
         };
     }
 }
+#endif
@@ -15,6 +15,10 @@
 #pragma once
 
 #include <string>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <ostream>
 
 #ifndef __STRING_UTILS__H__
 #define __STRING_UTILS__H__
@@ -23,6 +27,59 @@ namespace cxx_utils
 {
     namespace string
     {
+        /**
+         * @brief A non-owning (pointer, length) view over a run of chars.
+         *
+         * The referenced storage must outlive the string_ref; call str() to
+         * materialize an owning std::string when one is really needed.
+         */
+        class string_ref
+        {
+            const char  *m_data;
+            std::size_t  m_len;
+        public:
+            typedef const char *const_iterator;
+
+            string_ref() : m_data(""), m_len(0) {}
+            string_ref(const char *data, std::size_t len) :
+                m_data(data), m_len(len) {}
+            string_ref(const char *data) :
+                m_data(data), m_len(std::strlen(data)) {}
+            string_ref(const std::string &str) :
+                m_data(str.data()), m_len(str.size()) {}
+
+            const char *data() const { return m_data; }
+            std::size_t size() const { return m_len; }
+            std::size_t length() const { return m_len; }
+            bool empty() const { return m_len == 0; }
+
+            const_iterator begin() const { return m_data; }
+            const_iterator end() const { return m_data + m_len; }
+
+            char operator[](std::size_t pos) const { return m_data[pos]; }
+
+            std::string str() const { return std::string(m_data, m_len); }
+
+            bool operator==(const string_ref &rhs) const
+            {
+                return m_len == rhs.m_len &&
+                    (m_len == 0 || !std::memcmp(m_data, rhs.m_data, m_len));
+            }
+
+            bool operator!=(const string_ref &rhs) const
+            {
+                return !(*this == rhs);
+            }
+
+            friend
+            std::ostream &operator<<(std::ostream &output,
+                                     const string_ref &ref)
+            {
+                output.write(ref.m_data, ref.m_len);
+                return output;
+            }
+        };
+
         class utils
         {
         public:
@@ -89,6 +146,43 @@ namespace cxx_utils
                 return ( str1Cpy == str2Cpy );
             }
 
+            /**
+             * Case-insensitive equality without copying either side; the
+             * hot-path counterpart of istringcmp().
+             */
+            static inline bool iequals(const string_ref &str1,
+                                       const string_ref &str2)
+            {
+                if (str1.size() != str2.size())
+                    return false;
+
+                for (std::size_t i = 0; i < str1.size(); ++i) {
+                    if (str1[i] != str2[i] &&
+                        ::tolower((unsigned char)str1[i]) !=
+                        ::tolower((unsigned char)str2[i]))
+                        return false;
+                }
+                return true;
+            }
+
+            /**
+             * Returns @ref with any leading and trailing characters from
+             * @spaces removed; no allocation is performed.
+             */
+            static inline string_ref trim_ref(const string_ref &ref,
+                                              const char *spaces = " \t")
+            {
+                const char *first = ref.begin();
+                const char *last = ref.end();
+                while (first != last && *first &&
+                       std::strchr(spaces, *first))
+                    ++first;
+                while (last != first && *(last - 1) &&
+                       std::strchr(spaces, *(last - 1)))
+                    --last;
+                return string_ref(first, last - first);
+            }
+
         };
     }
 }
@@ -0,0 +1,120 @@
+#include "fd_buffer.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using cxx_utils::io::fd_buffer;
+
+static const std::size_t TOTAL = 512u << 20;
+static const std::size_t CHUNK = 65536;
+
+static int temp_file()
+{
+    char path[] = "/tmp/cxxutils_transfer_benchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+        std::exit(1);
+    unlink(path);
+    return fd;
+}
+
+/// The copy transfer() replaces: through an istream and an ostream.
+static std::size_t stream_copy(fd_buffer &src, fd_buffer &dst)
+{
+    std::istream in(&src);
+    std::ostream out(&dst);
+    std::vector<char> buf(CHUNK);
+    std::size_t total = 0;
+    while (in.read(&buf[0], CHUNK) || in.gcount()) {
+        out.write(&buf[0], in.gcount());
+        total += std::size_t(in.gcount());
+    }
+    out.flush();
+    return total;
+}
+
+static std::size_t kernel_copy(fd_buffer &src, fd_buffer &dst)
+{
+    return cxx_utils::io::transfer(src, dst);
+}
+
+static void report(const char *pName, std::size_t bytes,
+                   std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << pName << ": " << bytes / elapsed.count() / (1024.0 * 1024.0)
+              << " MB/s" << std::endl;
+}
+
+/// A thread fills a pipe; @copy moves it into a regular file.
+template <std::size_t (*copy)(fd_buffer &, fd_buffer &)>
+static void pipe_to_file(const char *pName)
+{
+    int fds[2];
+    if (pipe(fds))
+        std::exit(1);
+    std::thread producer([&fds]() {
+            std::vector<char> block(CHUNK, 'p');
+            for (std::size_t n = 0; n < TOTAL; n += CHUNK)
+                if (write(fds[1], &block[0], CHUNK) != ssize_t(CHUNK))
+                    break;
+            close(fds[1]);
+        });
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    fd_buffer src(fds[0], CHUNK), dst(temp_file(), CHUNK);
+    std::size_t moved = copy(src, dst);
+    producer.join();
+    report(pName, moved, start);
+}
+
+/// @copy sends a regular file into a socket a thread drains.
+template <std::size_t (*copy)(fd_buffer &, fd_buffer &)>
+static void file_to_socket(const char *pName, int file)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+        std::exit(1);
+    std::thread consumer([&sv]() {
+            std::vector<char> block(CHUNK);
+            while (read(sv[1], &block[0], CHUNK) > 0)
+                ;
+            close(sv[1]);
+        });
+
+    lseek(file, 0, SEEK_SET);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::size_t moved;
+    {
+        fd_buffer src(file, CHUNK, 8, false), dst(sv[0], CHUNK);
+        moved = copy(src, dst);
+    }
+    consumer.join();
+    report(pName, moved, start);
+}
+
+int main()
+{
+    pipe_to_file<stream_copy>("pipe -> file   istream/ostream");
+    pipe_to_file<kernel_copy>("pipe -> file   transfer()     ");
+
+    int file = temp_file();
+    std::vector<char> block(CHUNK, 'f');
+    for (std::size_t n = 0; n < TOTAL; n += CHUNK)
+        if (write(file, &block[0], CHUNK) != ssize_t(CHUNK))
+            return 1;
+
+    file_to_socket<stream_copy>("file -> socket istream/ostream", file);
+    file_to_socket<kernel_copy>("file -> socket transfer()     ", file);
+    close(file);
+    return 0;
+}
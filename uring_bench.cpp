@@ -0,0 +1,140 @@
+#include "uring_buffer.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using cxx_utils::io::fd_buffer;
+using cxx_utils::io::io_ring;
+using cxx_utils::io::uring_buffer;
+
+static const std::size_t TOTAL = 256u << 20;
+static const std::size_t BUFSIZE = 65536;
+static const std::size_t RECORD = 200;   // a log line, roughly
+
+static double mb_per_sec(std::size_t bytes,
+                         std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return bytes / elapsed.count() / (1024.0 * 1024.0);
+}
+
+/// Streams TOTAL bytes out in RECORD sized writes, then flushes.
+static bool produce(std::streambuf *pBuf)
+{
+    std::vector<char> record(RECORD, 'x');
+    record.back() = '\n';
+    std::ostream out(pBuf);
+    for (std::size_t n = 0; n < TOTAL; n += RECORD)
+        out.write(&record[0], RECORD);
+    out.flush();
+    return out.good();
+}
+
+/// Reads everything through the istream interface; returns the byte count.
+static std::size_t consume(std::streambuf *pBuf)
+{
+    std::istream in(pBuf);
+    std::vector<char> record(RECORD);
+    std::size_t total = 0;
+    while (in.read(&record[0], RECORD) || in.gcount())
+        total += std::size_t(in.gcount());
+    return total;
+}
+
+template <bool bUring>
+static void file_round(const char *pName)
+{
+    char path[] = "/tmp/cxxutils_uring_benchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+        std::exit(1);
+    unlink(path);
+
+    io_ring ring;
+    double write_rate, read_rate;
+    {
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        if (bUring) {
+            uring_buffer out(ring, dup(fd), BUFSIZE);
+            produce(&out);
+        } else {
+            fd_buffer out(dup(fd), BUFSIZE);
+            produce(&out);
+        }
+        write_rate = mb_per_sec(TOTAL, start);
+    }
+
+    lseek(fd, 0, SEEK_SET);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::size_t got;
+    if (bUring) {
+        uring_buffer in(ring, fd, BUFSIZE);
+        got = consume(&in);
+    } else {
+        fd_buffer in(fd, BUFSIZE);
+        got = consume(&in);
+    }
+    read_rate = mb_per_sec(got, start);
+
+    std::cout << pName << " file write : " << write_rate << " MB/s"
+              << std::endl;
+    std::cout << pName << " file read  : " << read_rate << " MB/s"
+              << std::endl;
+}
+
+template <bool bUring>
+static void pipe_round(const char *pName)
+{
+    int fds[2];
+    if (pipe(fds))
+        std::exit(1);
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::thread writer([&fds]() {
+            io_ring ring;
+            if (bUring) {
+                uring_buffer out(ring, fds[1], BUFSIZE);
+                produce(&out);
+            } else {
+                fd_buffer out(fds[1], BUFSIZE);
+                produce(&out);
+            }
+        });
+
+    io_ring ring;
+    std::size_t got;
+    if (bUring) {
+        uring_buffer in(ring, fds[0], BUFSIZE);
+        got = consume(&in);
+    } else {
+        fd_buffer in(fds[0], BUFSIZE);
+        got = consume(&in);
+    }
+    writer.join();
+
+    std::cout << pName << " pipe       : " << mb_per_sec(got, start)
+              << " MB/s" << std::endl;
+}
+
+int main()
+{
+    if (!io_ring().valid())
+        std::cout << "io_uring unavailable; uring_buffer falls back to "
+                  << "read()/write()" << std::endl;
+
+    file_round<false>("fd_buffer   ");
+    file_round<true>("uring_buffer");
+    pipe_round<false>("fd_buffer   ");
+    pipe_round<true>("uring_buffer");
+    return 0;
+}
@@ -0,0 +1,646 @@
+// "uring_buffer" -*- C++ -*-
+
+// Copyright (C) 2014 Aaron Conole
+//
+// This file is governed by the 'use this freely' common-sense license
+// This means the following:
+// - Take this header
+// - #include it in your project (commercial, or non)
+// - ???
+// - profit
+
+/** @file uring_buffer.hpp
+ * io_uring backed file-descriptor streambuf
+ */
+
+#pragma once
+
+#include "fd_buffer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__linux__) && !defined(CXX_UTILS_NO_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define CXX_UTILS_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifndef __URING_BUFFER__H__
+#define __URING_BUFFER__H__
+
+namespace cxx_utils
+{
+    namespace io
+    {
+        /**
+         * \brief A submission/completion ring shared by any number of
+         * uring_buffer objects.
+         *
+         * The ring is driven with the raw io_uring_setup/io_uring_enter
+         * system calls, so there is no liburing dependency. When the kernel
+         * (or a seccomp policy) refuses io_uring, valid() is false and the
+         * buffers using the ring fall back to plain read()/write().
+         *
+         * Not thread safe: use one ring per thread.
+         */
+        class io_ring
+        {
+        public:
+            /// Something waiting on a completion; user_data points at it.
+            struct request
+            {
+                virtual ~request() {}
+                virtual void complete(int nResult) = 0;
+            };
+
+            explicit io_ring(unsigned nEntries = 64)
+                : m_nRingFd(-1)
+            {
+#ifdef CXX_UTILS_HAVE_IO_URING
+                setup(nEntries);
+#else
+                (void)nEntries;
+#endif
+            }
+
+            ~io_ring()
+            {
+#ifdef CXX_UTILS_HAVE_IO_URING
+                if( m_nRingFd == -1 ) return;
+                munmap(m_pSqes, m_nSqesSize);
+                if( m_pCqRing != m_pSqRing ) munmap(m_pCqRing, m_nCqSize);
+                munmap(m_pSqRing, m_nSqSize);
+                close(m_nRingFd);
+#endif
+            }
+
+            bool valid() const { return m_nRingFd != -1; }
+
+#ifdef CXX_UTILS_HAVE_IO_URING
+            /**
+             * Returns a cleared submission entry for @pReq, submitting what
+             * is already queued when the ring is full. The entry reaches
+             * the kernel on the next submit() or wait().
+             */
+            io_uring_sqe *get_sqe(request *pReq)
+            {
+                if( m_nSqTail - __atomic_load_n(m_pSqHead, __ATOMIC_ACQUIRE) >=
+                    m_nSqEntries )
+                {
+                    submit();
+                    while( m_nSqTail -
+                           __atomic_load_n(m_pSqHead, __ATOMIC_ACQUIRE) >=
+                           m_nSqEntries )
+                        wait();
+                }
+
+                const unsigned idx = m_nSqTail & m_nSqMask;
+                io_uring_sqe *sqe = &m_pSqes[idx];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sqe->user_data = reinterpret_cast<std::uintptr_t>(pReq);
+                m_pSqArray[idx] = idx;
+                ++m_nSqTail;
+                return sqe;
+            }
+
+            /// Queues @nOp (a read or write) at the file position, or at @nOffset.
+            void prep_rw(int nOp, request *pReq, int nFileDes, void *buf,
+                         std::size_t len, std::int64_t nOffset = -1)
+            {
+                io_uring_sqe *sqe = get_sqe(pReq);
+                sqe->opcode = nOp;
+                sqe->fd = nFileDes;
+                sqe->addr = reinterpret_cast<std::uintptr_t>(buf);
+                sqe->len = unsigned(std::min<std::size_t>(len, 1u << 30));
+                sqe->off = std::uint64_t(nOffset);
+            }
+
+            /// Queues a one-shot wait for @nEvents (POLLIN, POLLOUT) on @nFileDes.
+            void prep_poll(request *pReq, int nFileDes, unsigned nEvents)
+            {
+                io_uring_sqe *sqe = get_sqe(pReq);
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->fd = nFileDes;
+                sqe->poll_events = std::uint16_t(nEvents);
+            }
+
+            /// Asks the kernel to cancel the request @pTarget.
+            void prep_cancel(request *pReq, request *pTarget)
+            {
+                io_uring_sqe *sqe = get_sqe(pReq);
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = -1;
+                sqe->addr = reinterpret_cast<std::uintptr_t>(pTarget);
+            }
+#endif
+
+            /**
+             * Hands queued entries to the kernel, optionally waiting until
+             * @nWait completions are available. One system call however many
+             * entries are queued.
+             */
+            int submit(unsigned nWait = 0)
+            {
+#ifdef CXX_UTILS_HAVE_IO_URING
+                const unsigned nQueued =
+                    m_nSqTail - __atomic_load_n(m_pSqTail, __ATOMIC_RELAXED);
+                if( !nQueued && !nWait ) return 0;
+                __atomic_store_n(m_pSqTail, m_nSqTail, __ATOMIC_RELEASE);
+
+                long ret;
+                do
+                {
+                    ret = syscall(__NR_io_uring_enter, m_nRingFd, nQueued,
+                                  nWait, nWait ? IORING_ENTER_GETEVENTS : 0,
+                                  NULL, 0);
+                } while( ret < 0 && errno == EINTR );
+                return int(ret);
+#else
+                (void)nWait;
+                return -1;
+#endif
+            }
+
+            /// Dispatches every completion already posted; never blocks.
+            std::size_t reap()
+            {
+                std::size_t nReaped = 0;
+#ifdef CXX_UTILS_HAVE_IO_URING
+                unsigned head = *m_pCqHead;
+                while( head != __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE) )
+                {
+                    const io_uring_cqe &cqe = m_pCqes[head & m_nCqMask];
+                    request *pReq = reinterpret_cast<request *>
+                        (std::uintptr_t(cqe.user_data));
+                    const int nResult = cqe.res;
+                    __atomic_store_n(m_pCqHead, ++head, __ATOMIC_RELEASE);
+                    if( pReq ) pReq->complete(nResult);
+                    ++nReaped;
+                }
+#endif
+                return nReaped;
+            }
+
+            /// Submits anything queued and blocks for at least one completion.
+            void wait()
+            {
+                if( reap() ) return;
+                submit(1);
+                reap();
+            }
+
+        private:
+            io_ring(const io_ring &);
+            io_ring &operator=(const io_ring &);
+
+            int m_nRingFd;
+#ifdef CXX_UTILS_HAVE_IO_URING
+            void setup(unsigned nEntries)
+            {
+                io_uring_params p;
+                std::memset(&p, 0, sizeof(p));
+                const int fd = int(syscall(__NR_io_uring_setup, nEntries, &p));
+                if( fd < 0 ) return;
+
+                m_nSqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+                m_nCqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+                const bool bSingle = p.features & IORING_FEAT_SINGLE_MMAP;
+                if( bSingle )
+                    m_nSqSize = m_nCqSize = std::max(m_nSqSize, m_nCqSize);
+
+                void *sq = mmap(0, m_nSqSize, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, fd,
+                                IORING_OFF_SQ_RING);
+                void *cq = bSingle ? sq :
+                    mmap(0, m_nCqSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+                m_nSqesSize = p.sq_entries * sizeof(io_uring_sqe);
+                void *sqes = mmap(0, m_nSqesSize, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, fd,
+                                  IORING_OFF_SQES);
+                if( sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED )
+                {
+                    if( sqes != MAP_FAILED ) munmap(sqes, m_nSqesSize);
+                    if( cq != MAP_FAILED && cq != sq ) munmap(cq, m_nCqSize);
+                    if( sq != MAP_FAILED ) munmap(sq, m_nSqSize);
+                    close(fd);
+                    return;
+                }
+
+                char *sqp = static_cast<char *>(sq);
+                char *cqp = static_cast<char *>(cq);
+                m_pSqRing = sq;
+                m_pCqRing = cq;
+                m_pSqes = static_cast<io_uring_sqe *>(sqes);
+                m_pSqHead = reinterpret_cast<unsigned *>(sqp + p.sq_off.head);
+                m_pSqTail = reinterpret_cast<unsigned *>(sqp + p.sq_off.tail);
+                m_pSqArray = reinterpret_cast<unsigned *>(sqp + p.sq_off.array);
+                m_nSqMask = *reinterpret_cast<unsigned *>(sqp + p.sq_off.ring_mask);
+                m_nSqEntries = p.sq_entries;
+                m_nSqTail = *m_pSqTail;
+                m_pCqHead = reinterpret_cast<unsigned *>(cqp + p.cq_off.head);
+                m_pCqTail = reinterpret_cast<unsigned *>(cqp + p.cq_off.tail);
+                m_pCqes = reinterpret_cast<io_uring_cqe *>(cqp + p.cq_off.cqes);
+                m_nCqMask = *reinterpret_cast<unsigned *>(cqp + p.cq_off.ring_mask);
+                m_nRingFd = fd;
+            }
+
+            void         *m_pSqRing;
+            void         *m_pCqRing;
+            std::size_t   m_nSqSize;
+            std::size_t   m_nCqSize;
+            std::size_t   m_nSqesSize;
+            io_uring_sqe *m_pSqes;
+            unsigned     *m_pSqHead;
+            unsigned     *m_pSqTail;
+            unsigned     *m_pSqArray;
+            unsigned      m_nSqMask;
+            unsigned      m_nSqEntries;
+            unsigned      m_nSqTail;     ///< local; published by submit()
+            unsigned     *m_pCqHead;
+            unsigned     *m_pCqTail;
+            io_uring_cqe *m_pCqes;
+            unsigned      m_nCqMask;
+#endif
+        };
+
+        /**
+         * \brief A fd_buffer whose reads and writes go through an io_ring.
+         *
+         * Reads run one buffer ahead: the kernel reads straight into a
+         * second get area while the caller parses the current one, and
+         * the two swap when the current one runs dry, so only the put-back
+         * bytes are ever copied. Output collects in the put area as usual;
+         * once @nWriteChunk bytes are there the area itself is handed to
+         * the kernel, without waiting, and a second one takes its place.
+         * One write is in flight at a time so output stays ordered; short
+         * writes are resubmitted, and a write that would block waits for
+         * POLLOUT on the ring before it is retried. Writes of a whole
+         * chunk or more are sent from the caller's memory and waited for.
+         * sync() (std::flush) waits for everything written so far; an
+         * error from an earlier write is reported by the next write or
+         * sync().
+         *
+         * The descriptor is owned by this buffer while it exists, since
+         * read-ahead consumes input before it is asked for.
+         */
+        class uring_buffer : public fd_buffer
+        {
+        public:
+            explicit uring_buffer(io_ring &rRing, int nFileDes,
+                                  std::size_t nBufSize = 65536,
+                                  std::size_t nPutBack = 8,
+                                  bool bOwner = true,
+                                  std::size_t nWriteChunk = 65536)
+                : fd_buffer(nFileDes, nBufSize, nPutBack, bOwner),
+                  m_rRing(rRing), m_cRead(this, &uring_buffer::read_done),
+                  m_cWrite(this, &uring_buffer::write_done),
+                  m_cCancel(this, 0),
+                  m_cAhead(m_cBuffer.size()), m_nReadResult(0),
+                  m_bReadDone(false), m_bReadEof(false),
+                  m_pFlight(0), m_nFlightPos(0), m_nFlightLen(0),
+                  m_bPollOut(false), m_nWriteErr(0)
+            {
+                // the read()/write() fallback keeps fd_buffer's put area
+                if( m_rRing.valid() )
+                    set_write_buffer(std::max<std::size_t>(nWriteChunk, 1));
+            }
+
+            virtual ~uring_buffer()
+            {
+                sync();
+                if( m_cRead.bBusy )
+                {
+#ifdef CXX_UTILS_HAVE_IO_URING
+                    // a pipe or socket read may never finish by itself
+                    m_rRing.prep_cancel(&m_cCancel, &m_cRead);
+#endif
+                    while( m_cRead.bBusy || m_cCancel.bBusy )
+                        m_rRing.wait();
+                }
+            }
+
+            /// True when requests really go through io_uring.
+            bool uring_active() const { return m_rRing.valid(); }
+
+            std::streambuf::int_type underflow()
+            {
+                if( !m_rRing.valid() ) return fd_buffer::underflow();
+                if( m_nFileDes == -1 )
+                    return traits_type::eof();
+                if( gptr() < egptr() )
+                    return traits_type::to_int_type(*gptr());
+
+                // the peer may be waiting on our output before it replies
+                if( pptr() != pbase() && start_write() < 0 )
+                    return traits_type::eof();
+
+                if( !m_cRead.bBusy && !m_bReadDone )
+                {
+                    if( m_bReadEof ) return traits_type::eof();
+                    start_read();
+                }
+                while( m_cRead.bBusy ) m_rRing.wait();
+                m_bReadDone = false;
+
+                if( m_nReadResult <= 0 )
+                {
+                    m_bReadEof = m_nReadResult == 0;
+                    m_eReadState = m_bReadEof ? io_eof :
+                        (m_nReadResult == -EAGAIN ||
+                         m_nReadResult == -EWOULDBLOCK) ? io_would_block :
+                        io_error;
+                    if( !m_bReadEof ) errno = -m_nReadResult;
+                    return traits_type::eof();
+                }
+
+                // the filled buffer becomes the get area, carrying the
+                // put-back bytes over; the old one takes the next read
+                const std::size_t keep =
+                    std::min<std::size_t>(m_nPutBack, egptr() - eback());
+                std::memcpy(&m_cAhead[m_nPutBack - keep], egptr() - keep, keep);
+                m_cBuffer.swap(m_cAhead);
+                char *start = BufferStart() + m_nPutBack;
+                setg(start - keep, start, start + m_nReadResult);
+                m_eReadState = io_ok;
+
+                start_read();
+                m_rRing.submit();
+                return traits_type::to_int_type(*gptr());
+            }
+
+            std::streamsize xsgetn(char *s, std::streamsize num)
+            {
+                if( !m_rRing.valid() ) return fd_buffer::xsgetn(s, num);
+
+                // the next read is already in flight, so never around it
+                std::streamsize got = 0;
+                while( got < num )
+                {
+                    const std::streamsize avail = egptr() - gptr();
+                    if( !avail )
+                    {
+                        if( traits_type::eq_int_type(underflow(),
+                                                     traits_type::eof()) )
+                            break;
+                        continue;
+                    }
+                    const std::streamsize n = std::min(avail, num - got);
+                    std::memcpy(s + got, gptr(), std::size_t(n));
+                    gbump(int(n));
+                    got += n;
+                }
+                return got;
+            }
+
+            std::streambuf::int_type overflow(std::streambuf::int_type c)
+            {
+                if( !m_rRing.valid() ) return fd_buffer::overflow(c);
+                if( m_nFileDes == -1 ||
+                    (pptr() != pbase() && start_write() < 0) )
+                    return traits_type::eof();
+                if( traits_type::eq_int_type(c, traits_type::eof()) )
+                    return traits_type::not_eof(c);
+
+                char z = traits_type::to_char_type(c);
+                if( !pbase() )  // set_write_buffer(0)
+                    return internal_write(&z, 1) == 1 ? c : traits_type::eof();
+                *pptr() = z;
+                pbump(1);
+                return c;
+            }
+
+            std::streamsize xsputn(const char *s, std::streamsize num)
+            {
+                if( !m_rRing.valid() ) return fd_buffer::xsputn(s, num);
+                if( m_nFileDes == -1 || num <= 0 )
+                    return 0;
+
+                std::streamsize sent = 0;
+                if( num >= epptr() - pbase() )
+                {
+                    // a chunk or more: queue what's buffered, then send
+                    // @s from where it is
+                    if( pptr() != pbase() && start_write() < 0 )
+                        return 0;
+                    const ssize_t result = internal_write(const_cast<char *>(s),
+                                                          std::size_t(num));
+                    return result < 0 ? 0 : std::streamsize(result);
+                }
+
+                while( sent < num )
+                {
+                    if( pptr() == epptr() && start_write() < 0 )
+                        break;
+                    const std::streamsize n =
+                        std::min<std::streamsize>(epptr() - pptr(), num - sent);
+                    std::memcpy(pptr(), s + sent, std::size_t(n));
+                    pbump(int(n));
+                    sent += n;
+                }
+                return sent;
+            }
+
+        protected:
+            /// One outstanding operation, completed by the ring.
+            struct op : io_ring::request
+            {
+                typedef void (uring_buffer::*handler)(int);
+
+                uring_buffer *pOwner;
+                handler       pfnDone;
+                bool          bBusy;
+
+                op(uring_buffer *pBuf, handler pfn)
+                    : pOwner(pBuf), pfnDone(pfn), bBusy(false) {}
+
+                virtual void complete(int nResult)
+                {
+                    bBusy = false;
+                    if( pfnDone ) (pOwner->*pfnDone)(nResult);
+                }
+            };
+
+            virtual int sync()
+            {
+                if( !m_rRing.valid() ) return fd_buffer::sync();
+                if( pptr() != pbase() && start_write() < 0 ) return -1;
+                return wait_write() ? 0 : -1;
+            }
+
+            /// A completed read-ahead counts as available input.
+            virtual std::streamsize showmanyc()
+            {
+                if( m_rRing.valid() )
+                {
+                    m_rRing.reap();
+                    if( m_bReadDone && m_nReadResult > 0 ) return m_nReadResult;
+                }
+                return fd_buffer::showmanyc();
+            }
+
+            /**
+             * Only reached through fd_buffer's own paths (transfer(),
+             * set_write_buffer()); sent in order after the write in flight
+             * and waited for.
+             */
+            virtual ssize_t internal_write(void *buf, size_t len)
+            {
+                if( !m_rRing.valid() )
+                    return fd_buffer::internal_write(buf, len);
+                if( !wait_write() ) return -1;
+
+                m_pFlight = static_cast<const char *>(buf);
+                m_nFlightPos = 0;
+                m_nFlightLen = len;
+                submit_flight();
+                if( !wait_write() && !m_nFlightPos ) return -1;
+                return ssize_t(m_nFlightPos);
+            }
+
+            /// Read-ahead and writes in flight rule out bypassing the ring.
+            virtual bool direct_io() const { return !m_rRing.valid(); }
+
+            virtual ssize_t internal_writev(const struct iovec *iov, int cnt)
+            {
+                if( !m_rRing.valid() )
+                    return fd_buffer::internal_writev(iov, cnt);
+
+                ssize_t total = 0;
+                for(int i = 0; i < cnt; ++i)
+                {
+                    const ssize_t result =
+                        internal_write(iov[i].iov_base, iov[i].iov_len);
+                    if( result < 0 ) return total ? total : -1;
+                    total += result;
+                    if( std::size_t(result) < iov[i].iov_len ) break;
+                }
+                return total;
+            }
+
+        private:
+            /// Reads into the spare buffer, past its put-back room.
+            void start_read()
+            {
+#ifdef CXX_UTILS_HAVE_IO_URING
+                m_cRead.bBusy = true;
+                m_rRing.prep_rw(IORING_OP_READ, &m_cRead, m_nFileDes,
+                                &m_cAhead[m_nPutBack],
+                                m_cAhead.size() - m_nPutBack);
+#endif
+            }
+
+            void read_done(int nResult)
+            {
+                m_nReadResult = nResult;
+                m_bReadDone = true;
+            }
+
+            /**
+             * Hands the put area to the kernel and puts the spare one in
+             * its place, once the previous write is done.
+             */
+            int start_write()
+            {
+                if( !wait_write() ) return -1;
+                const std::size_t pending = pptr() - pbase();
+                if( m_cOutFlight.size() < m_cOutBuffer.size() )
+                    m_cOutFlight.resize(m_cOutBuffer.size());
+                m_cOutBuffer.swap(m_cOutFlight);
+                char *base = &m_cOutBuffer.front();
+                setp(base, base + m_cOutBuffer.size());
+
+                m_pFlight = &m_cOutFlight.front();
+                m_nFlightPos = 0;
+                m_nFlightLen = pending;
+                submit_flight();
+                m_rRing.submit();
+                return 0;
+            }
+
+            void submit_flight()
+            {
+#ifdef CXX_UTILS_HAVE_IO_URING
+                m_cWrite.bBusy = true;
+                m_rRing.prep_rw(IORING_OP_WRITE, &m_cWrite, m_nFileDes,
+                                const_cast<char *>(m_pFlight + m_nFlightPos),
+                                m_nFlightLen - m_nFlightPos);
+#endif
+            }
+
+            void write_done(int nResult)
+            {
+                if( m_bPollOut )
+                {
+                    // the descriptor is writable (or in error: the write says)
+                    m_bPollOut = false;
+                    if( nResult < 0 && nResult != -EINTR )
+                    {
+                        m_nWriteErr = -nResult;
+                        return;
+                    }
+                }
+                else if( nResult == -EAGAIN || nResult == -EWOULDBLOCK )
+                {
+#ifdef CXX_UTILS_HAVE_IO_URING
+                    m_bPollOut = true;
+                    m_cWrite.bBusy = true;
+                    m_rRing.prep_poll(&m_cWrite, m_nFileDes, POLLOUT);
+                    m_rRing.submit();
+#endif
+                    return;
+                }
+                else if( nResult == -EINTR )
+                    nResult = 0;
+                else if( nResult <= 0 )
+                {
+                    m_nWriteErr = nResult < 0 ? -nResult : EIO;
+                    return;
+                }
+                else
+                    m_nFlightPos += std::size_t(nResult);
+
+                if( m_nFlightPos < m_nFlightLen )
+                {
+                    submit_flight();
+                    m_rRing.submit();
+                }
+            }
+
+            /// Waits out the write in flight; false (errno set) if any failed.
+            bool wait_write()
+            {
+                while( m_cWrite.bBusy && !m_nWriteErr ) m_rRing.wait();
+                if( !m_nWriteErr ) return true;
+                errno = m_nWriteErr;
+                m_nWriteErr = 0;
+                while( m_cWrite.bBusy ) m_rRing.wait();
+                setp(pbase(), epptr());
+                return false;
+            }
+
+            io_ring          &m_rRing;
+            op                m_cRead;
+            op                m_cWrite;
+            op                m_cCancel;
+            std::vector<char> m_cAhead;      ///< the get area being read into
+            int               m_nReadResult;
+            bool              m_bReadDone;   ///< m_nReadResult not yet used
+            bool              m_bReadEof;
+            std::vector<char> m_cOutFlight;  ///< the put area being written
+            const char       *m_pFlight;
+            std::size_t       m_nFlightPos;
+            std::size_t       m_nFlightLen;
+            bool              m_bPollOut;    ///< m_cWrite is a POLLOUT wait
+            int               m_nWriteErr;
+        };
+    }
+}
+#endif
@@ -0,0 +1,160 @@
+#include "http_utils.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using cxx_utils::net::http::utils;
+
+// The char-at-a-time implementations http_utils.hpp used to ship, kept here
+// as the baseline (with the negative-index bug on bytes >= 0x80 fixed).
+static std::string legacy_urldecode( const std::string &urltext )
+{
+    std::string result;
+
+    for(size_t i = 0; i < urltext.length(); ++i)
+    {
+        char c = urltext[i];
+        if (urltext[i] == '%')
+        {
+            if((i+2 < urltext.length()) &&
+               isxdigit(urltext[i+1]) && isxdigit(urltext[i+2]))
+            {
+                char *end;
+                std::string hexstr = urltext.substr(i+1, 2);
+                c = strtol(hexstr.c_str(), &end, 16);
+                if( end == NULL || *end != '\0')
+                    return result;
+                i+=2;
+                if (c == '+')
+                    c = ' ';
+            }
+            else
+                return result;
+        }
+        else if (urltext[i] == '+')
+        {
+            c = ' ';
+        }
+        result += c;
+    }
+    return result;
+}
+
+static std::string legacy_urlencode(const std::string uri)
+{
+    const std::string UNSAFECHARS = " /$&+,:;=?@'\"<>#%{}|\\^~[]`";
+    const char LOOKUP[] = "0123456789ABCDEF";
+    std::string result;
+
+    for (size_t i = 0; i < uri.length(); ++i)
+    {
+        unsigned char c = uri[i];
+        if (c == ' ')
+        {
+            c = '+';
+        }
+
+        if (c <= 31 || c >= 127 ||
+            UNSAFECHARS.find(c) != std::string::npos)
+        {
+            result += '%';
+            result += LOOKUP[c >> 4];
+            result += LOOKUP[c & 0xf];
+        }
+        else
+        {
+            result += c;
+        }
+    }
+    return result;
+}
+
+template <typename Fn>
+double mb_per_sec(const std::vector<std::string> &corpus, unsigned rounds,
+                  Fn fn)
+{
+    size_t bytes = 0;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < corpus.size(); ++i) {
+            bytes += corpus[i].size();
+            fn(corpus[i]);
+        }
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return bytes / elapsed.count() / (1024.0 * 1024.0);
+}
+
+int main()
+{
+    const char *plain_queries[] = {
+        "q=cheap flights to new york&from=2016-06-01&to=2016-06-14&adults=2",
+        "utm_source=newsletter&utm_medium=email&utm_campaign=summer_sale_2016"
+        "&utm_content=hero_banner&session=7f3a9c2e4b1d8f6a0e5c3b2a1d9f8e7c",
+        "redirect=https://accounts.example.com/login?next=/dashboard/settings"
+        "&client_id=web-frontend&scope=profile email openid&state=xyzzy",
+        "search=caf\xc3\xa9 cr\xc3\xa8me br\xc3\xbbl\xc3\xa9""e&page=3&sort=price_asc",
+        "token=eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9eyJzdWIiOiIxMjM0NTY3ODkwIi"
+        "wibmFtZSI6IkpvaG4gRG9lIiwiaWF0IjoxNTE2MjM5MDIyfQSflKxwRJSMeKKF2QT4"
+    };
+
+    std::vector<std::string> plain, encoded;
+    for (size_t i = 0; i < sizeof(plain_queries) / sizeof(plain_queries[0]);
+         ++i) {
+        plain.push_back(plain_queries[i]);
+        encoded.push_back(legacy_urlencode(plain_queries[i]));
+        if (utils::urlencode(plain.back()) != encoded.back() ||
+            utils::urldecode(encoded.back()) !=
+            legacy_urldecode(encoded.back())) {
+            std::cout << "Mismatch against the legacy implementation on ["
+                      << plain.back() << "]" << std::endl;
+            return 1;
+        }
+    }
+
+    const unsigned rounds = 200000;
+    size_t sink = 0;
+
+    double old_dec = mb_per_sec(encoded, rounds,
+                                [&sink](const std::string &s) {
+                                    sink += legacy_urldecode(s).size();
+                                });
+    double new_dec = mb_per_sec(encoded, rounds,
+                                [&sink](const std::string &s) {
+                                    sink += utils::urldecode(s).size();
+                                });
+    std::string scratch;
+    double inp_dec = mb_per_sec(encoded, rounds,
+                                [&sink, &scratch](const std::string &s) {
+                                    scratch.assign(s);
+                                    sink += utils::urldecode_inplace(scratch);
+                                });
+    double old_enc = mb_per_sec(plain, rounds,
+                                [&sink](const std::string &s) {
+                                    sink += legacy_urlencode(s).size();
+                                });
+    double new_enc = mb_per_sec(plain, rounds,
+                                [&sink](const std::string &s) {
+                                    sink += utils::urlencode(s).size();
+                                });
+    double app_enc = mb_per_sec(plain, rounds,
+                                [&sink, &scratch](const std::string &s) {
+                                    scratch.clear();
+                                    utils::urlencode_append(scratch, s.data(),
+                                                            s.size());
+                                    sink += scratch.size();
+                                });
+
+    std::cout << "urldecode  legacy   : " << old_dec << " MB/s" << std::endl;
+    std::cout << "urldecode  new      : " << new_dec << " MB/s" << std::endl;
+    std::cout << "urldecode  in-place : " << inp_dec << " MB/s" << std::endl;
+    std::cout << "urlencode  legacy   : " << old_enc << " MB/s" << std::endl;
+    std::cout << "urlencode  new      : " << new_enc << " MB/s" << std::endl;
+    std::cout << "urlencode  append   : " << app_enc << " MB/s" << std::endl;
+
+    return sink ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+#include "http_utils.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using cxx_utils::net::http::date_cache;
+using cxx_utils::net::http::utils;
+
+static const unsigned int ITERATIONS = 2000000;
+
+template <typename Fn>
+double ns_per_call(Fn fn)
+{
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < ITERATIONS; ++i)
+        fn();
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / ITERATIONS;
+}
+
+int main()
+{
+    size_t sink = 0;
+
+    double webdate = ns_per_call([&sink]() {
+            sink += utils::webdate(time(NULL)).size();
+        });
+
+    double cached = ns_per_call([&sink]() {
+            char buf[date_cache::length];
+            date_cache::instance().format(time(NULL), buf);
+            sink += buf[0];
+        });
+
+    double cached_str = ns_per_call([&sink]() {
+            sink += utils::httpdate(time(NULL)).size();
+        });
+
+    std::cout << "webdate(time(NULL))            : " << webdate
+              << " ns/call" << std::endl;
+    std::cout << "date_cache::format(char *)     : " << cached
+              << " ns/call" << std::endl;
+    std::cout << "httpdate(time(NULL)) (string)  : " << cached_str
+              << " ns/call" << std::endl;
+
+    // hammer the cache from several threads across a second boundary
+    std::vector<std::thread> threads;
+    std::atomic<unsigned int> bad(0);
+    for (int t = 0; t < 4; ++t) {
+        threads.push_back(std::thread([&bad]() {
+                    for (unsigned int i = 0; i < ITERATIONS / 4; ++i) {
+                        const time_t now = time(NULL) + (i & 1);
+                        char expect[date_cache::length];
+                        char got[date_cache::length];
+                        date_cache::render(now, expect);
+                        date_cache::instance().format(now, got);
+                        if (std::memcmp(expect, got, sizeof(got)))
+                            ++bad;
+                    }
+                }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+
+    std::cout << "concurrent mismatches          : " << bad << std::endl;
+    return (bad == 0 && sink) ? 0 : 1;
+}